@@ -1,11 +1,76 @@
 #include "core.hpp"
 #include "scene_importer.hpp"
 
+#include <chrono>
+#include <unordered_set>
+
+// set by the build, where fb_shader_builder precompiles the shaders to
+#ifndef FB_SHADER_CACHE_DIR
+#define FB_SHADER_CACHE_DIR "shader_cache"
+#endif
+
 namespace fb
 {
 
     using namespace lava;
 
+    namespace
+    {
+        // through the resource file system, so --res is respected
+        bool read_resource_file(const std::string &path, std::string &content)
+        {
+            unique_data file;
+            if (!load_file_data(path, file))
+                return false;
+            content.assign(file.ptr, file.size);
+            return true;
+        }
+
+        // seconds between two checks for edited shaders
+        constexpr float SHADER_WATCH_INTERVAL = 0.5f;
+
+        // shader of every compute pipeline, in CP order
+        constexpr std::array<const char *, CP::ssf_shade + 1> COMPUTE_SHADERS{
+            "calc_density",
+            "iso_extract",
+            "init_particles",
+            "sim_particles",
+            "sim_particles_density",
+            "init_particles_lattice",
+            "density_blocks",
+            "particle_aabbs",
+            "temporal_resolve",
+            "sample_allocation",
+            "upscale",
+            "wavefront_generate",
+            "wavefront_compact",
+            "point_cull",
+            "ssf_splat",
+            "ssf_smooth",
+            "ssf_shade",
+        };
+
+        // waits for all jobs (also after a failed one, they may still use what the caller is about to destroy)
+        bool wait_for_jobs(std::vector<std::future<bool>> &jobs)
+        {
+            bool result = true;
+            for (auto &job : jobs)
+            {
+                try
+                {
+                    result = job.get() && result;
+                }
+                catch (const std::exception &e)
+                {
+                    log()->error("pipeline job: {}", e.what());
+                    result = false;
+                }
+            }
+            jobs.clear();
+            return result;
+        }
+    }
+
     void core::on_pre_setup()
     {
         log()->debug("on_pre_setup");
@@ -18,11 +83,28 @@ namespace fb
             {"point.frag", "shaders/point.frag"},
 
             {"rgen", "shaders/core.rgen"},
+            {"rgen_pilot", "shaders/core_pilot.rgen"},
+            {"rgen_wavefront", "shaders/core_wavefront.rgen"},
             {"rmiss", "shaders/core.rmiss"},
             {"rchit", "shaders/core.rchit"},
+            {"rchit_procedural", "shaders/core_procedural.rchit"},
+            {"rint_density", "shaders/density_field.rint"},
+            {"rint_particle", "shaders/particle_sphere.rint"},
+            {"core_query", "shaders/core_query.comp"},
 
             {"calc_density", "shaders/calc_density.comp"},
             {"iso_extract", "shaders/iso_extract.comp"},
+            {"density_blocks", "shaders/density_blocks.comp"},
+            {"particle_aabbs", "shaders/particle_aabbs.comp"},
+            {"temporal_resolve", "shaders/temporal_resolve.comp"},
+            {"sample_allocation", "shaders/sample_allocation.comp"},
+            {"upscale", "shaders/upscale.comp"},
+            {"wavefront_generate", "shaders/wavefront_generate.comp"},
+            {"wavefront_compact", "shaders/wavefront_compact.comp"},
+            {"point_cull", "shaders/point_cull.comp"},
+            {"ssf_splat", "shaders/ssf_splat.comp"},
+            {"ssf_smooth", "shaders/ssf_smooth.comp"},
+            {"ssf_shade", "shaders/ssf_shade.comp"},
 
             {"init_particles", "shaders/init_particles.comp"},
             {"init_particles_lattice", "shaders/init_particles_lattice.comp"},
@@ -47,14 +129,57 @@ namespace fb
         log()->debug("on_setup");
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        app.producer.shader_debug = true;
-        app.producer.shader_opt = lava::producer::performance;
+        shaders = shader_cache::make(FB_SHADER_CACHE_DIR, read_resource_file, shader_options{.debug = true, .optimize = true});
 
         active_scene = std::make_shared<scene>(*this);
 
         auto scene_data = app.get_env().cmd_line.flags().contains("show_scene") ? app.props("scene") : cdata{};
 
-        scene_importer importer{scene_data, app.device};
+        if (app.get_env().cmd_line.params().contains("render_scale"))
+        {
+            std::string scale = app.get_env().cmd_line.params("render_scale").begin()->second;
+            try
+            {
+                set_render_scale(std::stof(scale));
+            }
+            catch (...)
+            {
+                log()->warn("invalid render scale {}", scale);
+            }
+        }
+        uniforms.temporal.checkerboard = app.get_env().cmd_line.flags().contains("checkerboard");
+        if (RAY_QUERY_AVAILIBLE && app.get_env().cmd_line.flags().contains("ray_query"))
+            tracer = TR::query_tracer;
+        if (RT_AVAILIBLE && app.get_env().cmd_line.flags().contains("wavefront"))
+            tracer = TR::wavefront_tracer;
+        shader_watch = !app.get_env().cmd_line.flags().contains("no_shader_watch");
+        if (app.get_env().cmd_line.flags().contains("screen_space"))
+        {
+            screen_space_fluid = true;
+            disable_rt = true;
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+        // the pipelines only need the layouts, so they are created on the workers while the scene is imported
+        // and the buffers (force field) are uploaded below
+        if (!setup_descriptors())
+            return false;
+
+        driver_pipeline_cache = pipeline_cache::make();
+        if (!driver_pipeline_cache->create(app.device, FB_SHADER_CACHE_DIR))
+            return false;
+
+        if (!setup_pipeline_layouts())
+            return false;
+
+        const auto pipelines_start = std::chrono::steady_clock::now();
+        if (!workers)
+            workers = thread_pool::make();
+        setup_pipelines();
+        setup_render_pipelines(app.shading.get_pass()->get());
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+        scene_importer importer{scene_data, app.device, app.props.get_filename("scene") + ".fbscene"};
 
         uniform_stride = uint32_t(align_up(sizeof(uniform_data),
                                            app.device->get_physical_device()->get_properties().limits.minUniformBufferOffsetAlignment));
@@ -67,7 +192,9 @@ namespace fb
 
 
 
-        sky_box = load_texture(app.device, app.props.get_filename("sky_box"), VK_FORMAT_R32G32B32_SFLOAT);
+        sky_box = environment_map::make();
+        if (!sky_box->load(app.device, app.props.get_filename("sky_box"), app.props("sky_box")))
+            return false;
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         if (!setup_buffers())
             return false;
@@ -79,13 +206,53 @@ namespace fb
                             VK_IMAGE_USAGE_TRANSFER_DST_BIT);
         rt_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
 
-        ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        if (!setup_descriptors())
-            return false;
+        guide_image = image::make(format);
+        guide_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT);
+        guide_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+
+        resolved_image = image::make(format);
+        resolved_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+        resolved_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+
+        history_image = image::make(format);
+        history_image->set_usage(VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        history_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+
+        pilot_image = image::make(format);
+        pilot_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT);
+        pilot_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+
+        weight_image = image::make(VK_FORMAT_R32_SFLOAT);
+        weight_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT);
+        weight_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+
+        upscaled_image = image::make(format);
+        upscaled_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+        upscaled_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+
+        ssf_depth_image = image::make(VK_FORMAT_R32_UINT);
+        ssf_depth_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        ssf_depth_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+
+        ssf_thickness_image = image::make(VK_FORMAT_R32_UINT);
+        ssf_thickness_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        ssf_thickness_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
+
+        ssf_smoothed_image = image::make(VK_FORMAT_R32_SFLOAT);
+        ssf_smoothed_image->set_usage(VK_IMAGE_USAGE_STORAGE_BIT);
+        ssf_smoothed_image->set_layout(VK_IMAGE_LAYOUT_UNDEFINED);
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        if (!setup_pipelines())
+        // the render pipelines are left to on_swapchain_create
+        const auto wait_start = std::chrono::steady_clock::now();
+        if (!wait_for_jobs(pipeline_jobs))
             return false;
+        const auto pipelines_end = std::chrono::steady_clock::now();
+        log()->info("pipelines: {:.1f} ms on {} threads, {:.1f} ms of it waited for ({} bytes from the pipeline cache)",
+                    std::chrono::duration<double, std::milli>(pipelines_end - pipelines_start).count(), workers->get_thread_count(),
+                    std::chrono::duration<double, std::milli>(pipelines_end - wait_start).count(),
+                    driver_pipeline_cache->get_loaded_size());
+        log()->debug("shaders not found in the shader cache (compiled now): {}", shaders->get_compile_count());
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         setup_meshes(importer);
@@ -93,15 +260,39 @@ namespace fb
         if (RT_AVAILIBLE)
         {
             log()->debug("creating acceleration structures");
-            for (auto &mesh : meshes)
+            for (uint32_t i = 0; i < meshes.size(); ++i)
             {
                 blas_list.push_back(rtt_extension::blas::make());
-                blas_list.back()->add_mesh(*mesh);
+                if (i < dynamic_meshes_offset)
+                    blas_list.back()->add_geometry(static_mesh_arena->get_triangles(i),
+                                                   {.primitiveCount = static_mesh_arena->get_range(i).index_count / 3});
+                else
+                    blas_list.back()->add_mesh(*meshes[i]);
                 blas_list.back()->create(app.device);
             }
 
+            density_blas = rtt_extension::blas::make();
+            density_blas->add_geometry(VkAccelerationStructureGeometryAabbsDataKHR{
+                                           .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
+                                           .data = {density_block_buffer->get_address()},
+                                           .stride = sizeof(VkAabbPositionsKHR)},
+                                       {.primitiveCount = SIDE_CUBE_GROUP_COUNT * SIDE_CUBE_GROUP_COUNT * SIDE_CUBE_GROUP_COUNT},
+                                       VK_GEOMETRY_OPAQUE_BIT_KHR);
+            density_blas->create(app.device, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR);
+
+            // sized for all particle slots; each build only covers the live particles
+            particle_blas = rtt_extension::blas::make();
+            particle_blas->add_geometry(VkAccelerationStructureGeometryAabbsDataKHR{
+                                            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
+                                            .data = {particle_aabb_buffer->get_address()},
+                                            .stride = sizeof(VkAabbPositionsKHR)},
+                                        {.primitiveCount = MAX_PARTICLES},
+                                        VK_GEOMETRY_OPAQUE_BIT_KHR);
+            particle_blas->create(app.device, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR);
+
             top_as = rtt_extension::tlas<instance_data>::make();
-            top_as->create(app.device, MAX_INSTANCE_COUNT);
+            top_as->create(app.device, MAX_INSTANCE_COUNT, app.block.get_frame_count(),
+                           VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
         }
 
         setup_scene(importer);
@@ -120,12 +311,14 @@ namespace fb
         uniforms.inv_view = glm::inverse(view);
         uniforms.inv_proj = glm::inverse(proj);
         uniforms.proj_view = proj * view;
+        uniforms.last_proj_view = uniforms.proj_view;
         uniforms.viewport = {0, 0, size};
         uniforms.background_color = {0, 0, 0, 1.0f};
         uniforms.time = 0;
         uniforms.swapchain_frame = 0;
         uniforms.sim.reset_num_particles = int(MAX_PARTICLES) / 3;
         uniforms.mesh_generation.kernel_radius = 1.0f / float(PARTICLE_CELLS_PER_SIDE);
+        uniforms.mesh_generation.side_voxel_count = SIDE_VOXEL_COUNT;
         uniforms.fluid.kernel_radius = uniforms.fluid.distance_multiplier / float(PARTICLE_CELLS_PER_SIDE);
 
         auto &cud = *reinterpret_cast<compute_uniform_data *>(compute_uniform_buffer->get_mapped_data());
@@ -135,6 +328,9 @@ namespace fb
             .particle_cells_per_side = PARTICLE_CELLS_PER_SIDE,
             .side_voxel_count = SIDE_VOXEL_COUNT,
             .side_force_field_size = SIDE_FORCE_FIELD_SIZE,
+            .force_field_slot_count = force_field->get_slot_count(),
+            .force_field_slot_stride = force_field->get_slot_stride(),
+            .force_field_format = force_field->get_format(),
         };
 
         app.camera.set_active(false);
@@ -169,14 +365,24 @@ namespace fb
 
 
         one_time_submit(app.device, app.device->graphics_queue(), [&](VkCommandBuffer cmd_buf){
-            sky_box->stage(cmd_buf);
+            sky_box->stage(cmd_buf, RT_AVAILIBLE);
 
             if (RT_AVAILIBLE){
                 log()->debug("initial acceleration structure build");
+                std::vector initial_blas_list = blas_list;
+                initial_blas_list.push_back(density_blas);
+                initial_blas_list.push_back(particle_blas);
                 std::vector vt{top_as};
-                scratch_buffer = rtt_extension::build_acceleration_structures(app.device, cmd_buf, begin(blas_list),
-                                                                              end(blas_list), begin(vt), end(vt),
-                                                                          scratch_buffer);
+
+                // all blas still have their maximum primitive counts (MAX_PRIMITIVES, MAX_PARTICLES), so this is the
+                // largest build there will be and the per frame rebuilds never have to grow the scratch buffer
+                as_scratch = rtt_extension::scratch_allocator::make();
+                as_scratch->create(app.device, app.block.get_frame_count(),
+                                   rtt_extension::required_scratch_size(begin(initial_blas_list), end(initial_blas_list), begin(vt), end(vt)));
+
+                rtt_extension::build_acceleration_structures(app.device, cmd_buf, begin(initial_blas_list),
+                                                             end(initial_blas_list), begin(vt), end(vt),
+                                                             *as_scratch);
             }
         });
 
@@ -190,9 +396,9 @@ namespace fb
         descriptor_pool = descriptor::pool::make();
         constexpr uint32_t set_count = 4;
         const VkDescriptorPoolSizes sizes = {
-            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
-            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2},
-            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 9},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 19},
             {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 4},
             {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
             {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2},
@@ -207,11 +413,41 @@ namespace fb
         shared_descriptor_set_layout->add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
                                                   VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_VERTEX_BIT |
                                                       VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR |
-                                                      VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+                                                      VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
+                                                      VK_SHADER_STAGE_INTERSECTION_BIT_KHR);
         shared_descriptor_set_layout->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-                                                  VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+                                                  VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+                                                      VK_SHADER_STAGE_COMPUTE_BIT);
         shared_descriptor_set_layout->add_binding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                                                   VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        shared_descriptor_set_layout->add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                  VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(6, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                  VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(7, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                  VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                  VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(9, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+        // wavefront tracer: paths, queues, indirect launch commands
+        shared_descriptor_set_layout->add_binding(10, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                  VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(11, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                  VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(12, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                  VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        // point cloud: visible particles, indirect draw command
+        shared_descriptor_set_layout->add_binding(13, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                  VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(14, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+        // screen space fluid: splatted depth, thickness, smoothed depth
+        shared_descriptor_set_layout->add_binding(15, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(16, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+        shared_descriptor_set_layout->add_binding(17, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+        // model matrices of the rasterized mesh nodes
+        shared_descriptor_set_layout->add_binding(18, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
 
         if (!shared_descriptor_set_layout->create(app.device))
             return false;
@@ -220,10 +456,18 @@ namespace fb
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         rt_descriptor_set_layout = descriptor::make();
 
+        // the compute stage is used by the ray query tracer (core_query.comp)
         rt_descriptor_set_layout->add_binding(0, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
-                                              VK_SHADER_STAGE_RAYGEN_BIT_KHR);
-        rt_descriptor_set_layout->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
-        rt_descriptor_set_layout->add_binding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_MISS_BIT_KHR);
+                                              VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        rt_descriptor_set_layout->add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                              VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        rt_descriptor_set_layout->add_binding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                              VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        rt_descriptor_set_layout->add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                              VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        rt_descriptor_set_layout->add_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                              VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT);
+        rt_descriptor_set_layout->add_binding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
 
         if (!rt_descriptor_set_layout->create(app.device))
             return false;
@@ -238,6 +482,10 @@ namespace fb
         compute_descriptor_set_layout->add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
         compute_descriptor_set_layout->add_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
         compute_descriptor_set_layout->add_binding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+        compute_descriptor_set_layout->add_binding(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+        compute_descriptor_set_layout->add_binding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+        // sky box for the screen space fluid (the tracers read it from the rt set)
+        compute_descriptor_set_layout->add_binding(8, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
 
         if (!compute_descriptor_set_layout->create(app.device))
             return false;
@@ -301,6 +549,51 @@ namespace fb
             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, VK_SHARING_MODE_CONCURRENT, shared_buffer_queue_indices))
             return false;
 
+        if (RT_AVAILIBLE)
+        {
+            // all blocks start inactive (NaN min corner), so the initial acceleration structure build is valid
+            std::vector density_blocks(SIDE_CUBE_GROUP_COUNT * SIDE_CUBE_GROUP_COUNT * SIDE_CUBE_GROUP_COUNT,
+                                       VkAabbPositionsKHR{.minX = std::numeric_limits<float>::quiet_NaN()});
+            density_block_buffer = buffer::make();
+            if (!density_block_buffer->create(app.device, density_blocks.data(), density_blocks.size() * sizeof(VkAabbPositionsKHR),
+                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                                                  VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                              false, VMA_MEMORY_USAGE_CPU_TO_GPU))
+                return false;
+
+            sample_allocation_buffer = buffer::make();
+            if (!sample_allocation_buffer->create(app.device, nullptr, sizeof(uint32_t),
+                                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT))
+                return false;
+
+            std::vector particle_aabbs(MAX_PARTICLES, VkAabbPositionsKHR{.minX = std::numeric_limits<float>::quiet_NaN()});
+            particle_aabb_buffer = buffer::make();
+            if (!particle_aabb_buffer->create(app.device, particle_aabbs.data(), particle_aabbs.size() * sizeof(VkAabbPositionsKHR),
+                                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                                                  VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                                              false, VMA_MEMORY_USAGE_CPU_TO_GPU))
+                return false;
+
+            query_tile_buffer = buffer::make();
+            if (!query_tile_buffer->create(app.device, nullptr, sizeof(uint32_t),
+                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT))
+                return false;
+
+            const VkQueryPoolCreateInfo pool_info = {
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = 2 * app.target->get_frame_count()};
+            if (vkCreateQueryPool(app.device->get(), &pool_info, memory::instance().alloc(), &trace_timestamp_pool) != VK_SUCCESS)
+                return false;
+            trace_timestamps_written.assign(app.target->get_frame_count(), false);
+
+            wavefront_command_buffer = buffer::make();
+            if (!wavefront_command_buffer->create(app.device, nullptr, 8 * sizeof(uint32_t),
+                                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
+                return false;
+        }
+
         particle_head_grid = buffer::make();
         std::vector negative_ones(NUM_PARTICLE_BUFFER_SLICES * particle_head_grid_stride,-1);
         if (!particle_head_grid->create(app.device, negative_ones.data(), NUM_PARTICLE_BUFFER_SLICES * particle_head_grid_stride,
@@ -314,21 +607,38 @@ namespace fb
                                      VMA_MEMORY_USAGE_CPU_TO_GPU, VK_SHARING_MODE_CONCURRENT, shared_buffer_queue_indices))
             return false;
 
-        particle_force_field = buffer::make();
-        cdata ff_data = app.props("field");
-        uint32_t single_frame_buffer_size = SIDE_FORCE_FIELD_SIZE * SIDE_FORCE_FIELD_SIZE * SIDE_FORCE_FIELD_SIZE * 4 * sizeof(float);
+        // only the graphics queue touches the point buffers: point_cull is recorded into the frame's graphics command
+        // buffer (on_render, not the async compute submission) right before the draws and splats reading them, so they
+        // are exclusive to the graphics family and ordered by pipeline barriers alone
+        point_buffer = buffer::make();
+        if (!point_buffer->create(app.device, nullptr, MAX_PARTICLES * 4 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
+            return false;
 
-        if (ff_data.size % single_frame_buffer_size != 0)
-        {
-            log()->error("force field size incompatibility");
+        point_draw_buffer = buffer::make();
+        if (!point_draw_buffer->create(app.device, nullptr, sizeof(VkDrawIndirectCommand),
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                           VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT))
             return false;
-        }
-        force_field_animation_frames = ff_data.size / single_frame_buffer_size;
 
-        if (!particle_force_field->create(app.device, ff_data.ptr, ff_data.size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                          false, VmaMemoryUsage::VMA_MEMORY_USAGE_CPU_TO_GPU))
+        raster_command_buffer = buffer::make();
+        if (!raster_command_buffer->create_mapped(app.device, nullptr,
+                                                  app.target->get_frame_count() * MAX_RASTER_DRAWS * sizeof(VkDrawIndexedIndirectCommand),
+                                                  VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU))
             return false;
 
+        raster_transform_buffer = buffer::make();
+        if (!raster_transform_buffer->create_mapped(app.device, nullptr,
+                                                    app.target->get_frame_count() * MAX_RASTER_DRAWS * sizeof(glm::mat4),
+                                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU))
+            return false;
+        raster_slices.assign(app.target->get_frame_count(), raster_slice{});
+
+        // only the frames around the animation cursor are uploaded, the rest stays in the mapped file
+        force_field = force_field_stream::make();
+        if (!force_field->create(app.device, workers, app.props.get_filename("field"), SIDE_FORCE_FIELD_SIZE, FORCE_FIELD_SLOTS))
+            return false;
+        force_field_animation_frames = force_field->get_frame_count();
+
         return true;
     }
 
@@ -336,8 +646,10 @@ namespace fb
     {
         log()->debug("setup_meshes");
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+        // the imported (static) meshes live in the arena, device local
+        static_mesh_arena = mesh_arena::make();
         std::vector<std::string> names;
-        std::tie(meshes, names) = importer.load_meshes();
+        std::tie(meshes, names) = importer.load_meshes(*static_mesh_arena);
         for (int i = 0; i < names.size(); ++i)
         {
             mesh_index_lut.insert({names[i], i});
@@ -367,6 +679,23 @@ namespace fb
         uniforms.fluid_model = glm::identity<glm::mat4>() * 0.25f;
         uniforms.fluid_model[3][3] = 1.0f;
         active_scene->add_node(0, "fluid", scene_fluid_model, node_type::mesh, payload);
+
+        if (RT_AVAILIBLE)
+        {
+            // uses the second hit group (procedural closest hit + density field intersection)
+            auto [ok, id] = top_as->add_instance(*density_blas, glm::mat4x3(scene_fluid_model), instance_data{}, 1, 0,
+                                                 IM::fluid_density_instance);
+            if (ok)
+                instance_count++;
+            density_instance_id = id;
+
+            // uses the third hit group (procedural closest hit + particle sphere intersection)
+            std::tie(ok, id) = top_as->add_instance(*particle_blas, glm::mat4x3(uniforms.fluid_model), instance_data{}, 2, 0,
+                                                    IM::fluid_particle_instance);
+            if (ok)
+                instance_count++;
+            particle_instance_id = id;
+        }
     }
 
     void core::setup_descriptor_writes()
@@ -465,12 +794,57 @@ namespace fb
                                  .dstBinding = 4,
                                  .descriptorCount = 1,
                                  .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                                 .pBufferInfo = particle_force_field->get_descriptor_info()},
+                                 .pBufferInfo = force_field->get_buffer()->get_descriptor_info()},
+            VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                 .dstSet = shared_descriptor_set,
+                                 .dstBinding = 13,
+                                 .descriptorCount = 1,
+                                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                 .pBufferInfo = point_buffer->get_descriptor_info()},
+            VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                 .dstSet = shared_descriptor_set,
+                                 .dstBinding = 14,
+                                 .descriptorCount = 1,
+                                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                 .pBufferInfo = point_draw_buffer->get_descriptor_info()},
+            VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                 .dstSet = shared_descriptor_set,
+                                 .dstBinding = 18,
+                                 .descriptorCount = 1,
+                                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                 .pBufferInfo = raster_transform_buffer->get_descriptor_info()},
+            VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                 .dstSet = compute_descriptor_set,
+                                 .dstBinding = 8,
+                                 .descriptorCount = 1,
+                                 .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                 .pImageInfo = sky_box->get_descriptor_info()},
 
         };
 
         if (RT_AVAILIBLE)
         {
+            write_sets.push_back(VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = compute_descriptor_set,
+                                                      .dstBinding = 6,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                      .pBufferInfo = density_block_buffer->get_descriptor_info()});
+
+            write_sets.push_back(VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = shared_descriptor_set,
+                                                      .dstBinding = 8,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                      .pBufferInfo = sample_allocation_buffer->get_descriptor_info()});
+
+            write_sets.push_back(VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = compute_descriptor_set,
+                                                      .dstBinding = 7,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                      .pBufferInfo = particle_aabb_buffer->get_descriptor_info()});
+
             write_sets.push_back(VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                                                       .dstSet = rt_descriptor_set,
                                                       .dstBinding = 1,
@@ -491,14 +865,42 @@ namespace fb
                                                       .descriptorCount = 1,
                                                       .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                                                       .pImageInfo = sky_box->get_descriptor_info()});
+
+            write_sets.push_back(VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = rt_descriptor_set,
+                                                      .dstBinding = 3,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                      .pBufferInfo = compute_density_buffer->get_descriptor_info()});
+
+            write_sets.push_back(VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = rt_descriptor_set,
+                                                      .dstBinding = 4,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                      .pBufferInfo = particle_aabb_buffer->get_descriptor_info()});
+
+            write_sets.push_back(VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = rt_descriptor_set,
+                                                      .dstBinding = 5,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                      .pBufferInfo = query_tile_buffer->get_descriptor_info()});
+
+            write_sets.push_back(VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = shared_descriptor_set,
+                                                      .dstBinding = 12,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                      .pBufferInfo = wavefront_command_buffer->get_descriptor_info()});
         }
 
         app.device->vkUpdateDescriptorSets(uint32_t(write_sets.size()), write_sets.data());
     }
 
-    bool core::setup_pipelines()
+    bool core::setup_pipeline_layouts()
     {
-        log()->debug("setup_pipelines");
+        log()->debug("setup_pipeline_layouts");
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         blit_pipeline_layout = pipeline_layout::make();
         blit_pipeline_layout->add(shared_descriptor_set_layout);
@@ -508,7 +910,8 @@ namespace fb
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         raster_pipeline_layout = pipeline_layout::make();
         raster_pipeline_layout->add(shared_descriptor_set_layout);
-        raster_pipeline_layout->add_push_constant_range({VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4)});
+        // first transform index of the draw (gl_InstanceIndex is added on top)
+        raster_pipeline_layout->add_push_constant_range({VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t)});
         if (!raster_pipeline_layout->create(app.device))
             return false;
 
@@ -525,21 +928,17 @@ namespace fb
             rt_pipeline_layout = pipeline_layout::make();
             rt_pipeline_layout->add(shared_descriptor_set_layout);
             rt_pipeline_layout->add(rt_descriptor_set_layout);
+            rt_pipeline_layout->add_push_constant_range({VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, sizeof(wavefront_constants)});
             if (!rt_pipeline_layout->create(app.device))
                 return false;
+        }
 
-            rt_pipeline = rtt_extension::raytracing_pipeline::make(app.device, app.pipeline_cache);
-
-            if (!rt_pipeline->add_ray_gen_shader(app.producer.get_shader("rgen")))
-                return false;
-            if (!rt_pipeline->add_miss_shader(app.producer.get_shader("rmiss")))
-                return false;
-            if (!rt_pipeline->add_closest_hit_shader(app.producer.get_shader("rchit")))
-                return false;
-
-            rt_pipeline->set_layout(rt_pipeline_layout);
-
-            if (!rt_pipeline->create())
+        if (RAY_QUERY_AVAILIBLE)
+        {
+            query_pipeline_layout = pipeline_layout::make();
+            query_pipeline_layout->add(shared_descriptor_set_layout);
+            query_pipeline_layout->add(rt_descriptor_set_layout);
+            if (!query_pipeline_layout->create(app.device))
                 return false;
         }
 
@@ -548,54 +947,241 @@ namespace fb
         compute_pipeline_layout->add(shared_descriptor_set_layout);
         compute_pipeline_layout->add(compute_descriptor_set_layout);
         compute_pipeline_layout->add(particle_descriptor_set_layout);
+        compute_pipeline_layout->add_push_constant_range({VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(wavefront_constants)});
         if (!compute_pipeline_layout->create(app.device))
             return false;
 
+        return true;
+    }
 
-        compute_pipelines.push_back(compute_pipeline::make(app.device, app.pipeline_cache));
-        compute_pipelines.back()->set_shader_stage(app.producer.get_shader("calc_density"), VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT);
-        compute_pipelines.back()->set_layout(compute_pipeline_layout);
-        if (!compute_pipelines.back()->create())
-            return false;
+    // every pipeline (and the shader modules it compiles) is one job; the results are collected by wait_for_jobs
+    void core::setup_pipelines()
+    {
+        log()->debug("setup_pipelines");
+        if (RT_AVAILIBLE)
+        {
+            pipeline_jobs.push_back(workers->submit([this]
+            {
+                rt_pipeline = create_rt_pipeline();
+                return rt_pipeline != nullptr;
+            }));
+        }
 
-        compute_pipelines.push_back(compute_pipeline::make(app.device, app.pipeline_cache));
-        compute_pipelines.back()->set_shader_stage(app.producer.get_shader("iso_extract"), VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT);
-        compute_pipelines.back()->set_layout(compute_pipeline_layout);
-        if (!compute_pipelines.back()->create())
-            return false;
+        if (RAY_QUERY_AVAILIBLE)
+        {
+            pipeline_jobs.push_back(workers->submit([this]
+            {
+                query_pipeline = create_query_pipeline();
+                return query_pipeline != nullptr;
+            }));
+        }
 
-        compute_pipelines.push_back(compute_pipeline::make(app.device, app.pipeline_cache));
-        compute_pipelines.back()->set_shader_stage(app.producer.get_shader("init_particles"), VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT);
-        compute_pipelines.back()->set_layout(compute_pipeline_layout);
-        if (!compute_pipelines.back()->create())
-            return false;
+        // indexed by CP, the jobs fill their own slot
+        compute_pipelines.assign(COMPUTE_SHADERS.size(), nullptr);
+        for (uint32_t index = 0; index < COMPUTE_SHADERS.size(); index++)
+        {
+            pipeline_jobs.push_back(workers->submit([this, index]
+            {
+                compute_pipelines[index] = create_compute_pipeline(CP(index));
+                return compute_pipelines[index] != nullptr;
+            }));
+        }
+    }
 
-        compute_pipelines.push_back(compute_pipeline::make(app.device, app.pipeline_cache));
-        compute_pipelines.back()->set_shader_stage(app.producer.get_shader("sim_particles"), VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT);
-        compute_pipelines.back()->set_layout(compute_pipeline_layout);
-        if (!compute_pipelines.back()->create())
-            return false;
+    // the on_process callbacks are set by add_render_pipelines, the jobs only create the pipelines
+    void core::setup_render_pipelines(VkRenderPass render_pass)
+    {
+        log()->debug("setup_render_pipelines");
+        render_pipelines_pass = render_pass;
 
-        compute_pipelines.push_back(compute_pipeline::make(app.device, app.pipeline_cache));
-        compute_pipelines.back()->set_shader_stage(app.producer.get_shader("sim_particles_density"), VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT);
-        compute_pipelines.back()->set_layout(compute_pipeline_layout);
-        if (!compute_pipelines.back()->create())
-            return false;
+        render_pipeline_jobs.push_back(workers->submit([this, render_pass]
+        {
+            blit_pipeline = create_blit_pipeline(render_pass);
+            return blit_pipeline != nullptr;
+        }));
+        render_pipeline_jobs.push_back(workers->submit([this, render_pass]
+        {
+            raster_pipeline = create_raster_pipeline(render_pass);
+            return raster_pipeline != nullptr;
+        }));
+        render_pipeline_jobs.push_back(workers->submit([this, render_pass]
+        {
+            point_cloud_pipeline = create_point_cloud_pipeline(render_pass);
+            return point_cloud_pipeline != nullptr;
+        }));
+    }
 
-        compute_pipelines.push_back(compute_pipeline::make(app.device, app.pipeline_cache));
-        compute_pipelines.back()->set_shader_stage(app.producer.get_shader("init_particles_lattice"), VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT);
-        compute_pipelines.back()->set_layout(compute_pipeline_layout);
-        if (!compute_pipelines.back()->create())
-            return false;
+    // the pipelines started in on_setup if they were created for render_pass, otherwise new ones
+    bool core::create_render_pipelines(VkRenderPass render_pass)
+    {
+        if (render_pipeline_jobs.empty() || render_pipelines_pass != render_pass)
+        {
+            if (!render_pipeline_jobs.empty())
+            {
+                log()->debug("render pass changed since on_setup, recreating the render pipelines");
+                wait_for_jobs(render_pipeline_jobs);
+                for (auto &pipeline : {blit_pipeline, raster_pipeline, point_cloud_pipeline})
+                {
+                    if (pipeline)
+                        pipeline->destroy();
+                }
+            }
+            setup_render_pipelines(render_pass);
+        }
+        return wait_for_jobs(render_pipeline_jobs);
+    }
 
-        return true;
+    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // the create_*_pipeline functions return nullptr on failure, so a failed reload keeps the running pipeline
+
+    rtt_extension::raytracing_pipeline::ptr core::create_rt_pipeline()
+    {
+        auto pipeline = rtt_extension::raytracing_pipeline::make(app.device, driver_pipeline_cache->get());
+
+        const bool shaders_added = pipeline->add_ray_gen_shader(get_shader("rgen")) &&
+                                   pipeline->add_ray_gen_shader(get_shader("rgen_pilot")) &&
+                                   pipeline->add_ray_gen_shader(get_shader("rgen_wavefront")) &&
+                                   pipeline->add_miss_shader(get_shader("rmiss")) &&
+                                   pipeline->add_closest_hit_shader(get_shader("rchit")) &&
+                                   pipeline->add_hit_shader_group(get_shader("rchit_procedural"), {},
+                                                                  get_shader("rint_density"), false) &&
+                                   pipeline->add_hit_shader_group(get_shader("rchit_procedural"), {},
+                                                                  get_shader("rint_particle"), false);
+
+        pipeline->set_layout(rt_pipeline_layout);
+        if (!shaders_added || !pipeline->create())
+        {
+            pipeline->destroy();
+            return nullptr;
+        }
+        return pipeline;
+    }
+
+    compute_pipeline::ptr core::create_query_pipeline()
+    {
+        auto pipeline = compute_pipeline::make(app.device, driver_pipeline_cache->get());
+        pipeline->set_shader_stage(get_shader("core_query"), VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT);
+        pipeline->set_layout(query_pipeline_layout);
+        if (!pipeline->create())
+        {
+            pipeline->destroy();
+            return nullptr;
+        }
+        return pipeline;
+    }
+
+    compute_pipeline::ptr core::create_compute_pipeline(CP index)
+    {
+        auto pipeline = compute_pipeline::make(app.device, driver_pipeline_cache->get());
+        pipeline->set_shader_stage(get_shader(COMPUTE_SHADERS[index]), VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT);
+        pipeline->set_layout(compute_pipeline_layout);
+        if (!pipeline->create())
+        {
+            pipeline->destroy();
+            return nullptr;
+        }
+        return pipeline;
+    }
+
+    render_pipeline::ptr core::create_blit_pipeline(VkRenderPass render_pass)
+    {
+        auto pipeline = render_pipeline::make(app.device, driver_pipeline_cache->get());
+
+        const bool shaders_added = pipeline->add_shader(get_shader("blit.vert"), VK_SHADER_STAGE_VERTEX_BIT) &&
+                                   pipeline->add_shader(get_shader("blit.frag"), VK_SHADER_STAGE_FRAGMENT_BIT);
+
+        pipeline->add_color_blend_attachment();
+        pipeline->set_layout(blit_pipeline_layout);
+
+        if (!shaders_added || !pipeline->create(render_pass))
+        {
+            pipeline->destroy();
+            return nullptr;
+        }
+        return pipeline;
+    }
+
+    render_pipeline::ptr core::create_raster_pipeline(VkRenderPass render_pass)
+    {
+        auto pipeline = render_pipeline::make(app.device, driver_pipeline_cache->get());
+
+        const bool shaders_added = pipeline->add_shader(get_shader("raster.vert"), VK_SHADER_STAGE_VERTEX_BIT) &&
+                                   pipeline->add_shader(get_shader("raster.frag"), VK_SHADER_STAGE_FRAGMENT_BIT);
+
+        pipeline->add_color_blend_attachment();
+        pipeline->set_layout(raster_pipeline_layout);
+        pipeline->set_rasterization_polygon_mode(VK_POLYGON_MODE_LINE);
+
+        pipeline->set_vertex_input_binding({0, sizeof(vert), VK_VERTEX_INPUT_RATE_VERTEX});
+        pipeline->set_vertex_input_attributes({
+            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, to_ui32(offsetof(vert, position))},
+            {1, 0, VK_FORMAT_R32G32B32_SFLOAT, to_ui32(offsetof(vert, normal))},
+        });
+
+        pipeline->set_depth_test_and_write();
+        pipeline->set_depth_compare_op(VK_COMPARE_OP_LESS_OR_EQUAL);
+
+        if (!shaders_added || !pipeline->create(render_pass))
+        {
+            pipeline->destroy();
+            return nullptr;
+        }
+        return pipeline;
+    }
+
+    render_pipeline::ptr core::create_point_cloud_pipeline(VkRenderPass render_pass)
+    {
+        auto pipeline = render_pipeline::make(app.device, driver_pipeline_cache->get());
+
+        const bool shaders_added = pipeline->add_shader(get_shader("point.vert"), VK_SHADER_STAGE_VERTEX_BIT) &&
+                                   pipeline->add_shader(get_shader("point.frag"), VK_SHADER_STAGE_FRAGMENT_BIT);
+
+        pipeline->add_color_blend_attachment();
+        pipeline->set_layout(point_cloud_pipeline_layout);
+
+        pipeline->set_depth_test_and_write();
+        pipeline->set_depth_compare_op(VK_COMPARE_OP_LESS_OR_EQUAL);
+        pipeline->set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+
+        if (!shaders_added || !pipeline->create(render_pass))
+        {
+            pipeline->destroy();
+            return nullptr;
+        }
+        return pipeline;
     }
 
     void core::on_clean_up()
     {
         log()->debug("on_clean_up");
+        // all pipelines were created by now (also the ones of on_swapchain_create, unless it never ran)
+        wait_for_jobs(render_pipeline_jobs);
+        if (pending_reload)
+        {
+            wait_for_jobs(pending_reload->jobs);
+            for (auto &pipeline : pending_reload->compute_pipelines)
+            {
+                if (pipeline)
+                    pipeline->destroy();
+            }
+            if (pending_reload->rt_pipeline)
+                pending_reload->rt_pipeline->destroy();
+            if (pending_reload->query_pipeline)
+                pending_reload->query_pipeline->destroy();
+            for (auto *pipeline : {&pending_reload->blit_pipeline, &pending_reload->raster_pipeline, &pending_reload->point_cloud_pipeline})
+            {
+                if (*pipeline)
+                    (*pipeline)->destroy();
+            }
+            pending_reload.reset();
+        }
+        driver_pipeline_cache->save();
+        driver_pipeline_cache->destroy();
+
         if (RT_AVAILIBLE)
             rt_pipeline->destroy();
+        if (RAY_QUERY_AVAILIBLE)
+            query_pipeline->destroy();
 
         for (auto &pipeline : compute_pipelines)
         {
@@ -606,6 +1192,8 @@ namespace fb
         raster_pipeline_layout->destroy();
         if (RT_AVAILIBLE)
             rt_pipeline_layout->destroy();
+        if (RAY_QUERY_AVAILIBLE)
+            query_pipeline_layout->destroy();
         compute_pipeline_layout->destroy();
         point_cloud_pipeline_layout->destroy();
 
@@ -620,9 +1208,19 @@ namespace fb
         if (RT_AVAILIBLE)
         {
             blas_list.clear();
+            density_blas.reset();
+            particle_blas.reset();
             top_as->destroy();
 
-            scratch_buffer->destroy();
+            as_scratch->destroy();
+            density_block_buffer->destroy();
+            particle_aabb_buffer->destroy();
+            sample_allocation_buffer->destroy();
+            query_tile_buffer->destroy();
+            wavefront_ray_buffer->destroy();
+            wavefront_queue_buffer->destroy();
+            wavefront_command_buffer->destroy();
+            vkDestroyQueryPool(app.device->get(), trace_timestamp_pool, memory::instance().alloc());
         }
 
         uniform_buffer->destroy();
@@ -633,7 +1231,13 @@ namespace fb
         compute_debug_buffer->destroy();
         particle_head_grid->destroy();
         particle_memory->destroy();
-        particle_force_field->destroy();
+        force_field->destroy();
+        static_mesh_arena->destroy();
+        raster_command_buffer->destroy();
+        raster_transform_buffer->destroy();
+        point_buffer->destroy();
+        point_draw_buffer->destroy();
+        sky_box->destroy();
     }
 
     bool core::on_resize()
@@ -646,6 +1250,16 @@ namespace fb
         uniforms.proj_view = glm::inverse(uniforms.inv_proj) * glm::inverse(uniforms.inv_view);
         uniforms.viewport = {0, 0, window_size};
 
+        return setup_render_targets();
+    }
+
+    bool core::setup_render_targets()
+    {
+        const glm::uvec2 window_size = app.target->get_size();
+        const glm::uvec2 trace_size = glm::max(glm::uvec2(glm::round(glm::vec2(window_size) * render_scale)), glm::uvec2(1));
+        uniforms.trace_viewport = {0, 0, trace_size};
+        applied_render_scale = render_scale;
+
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         if (rt_sampler)
         {
@@ -653,8 +1267,36 @@ namespace fb
             rt_sampler = VK_NULL_HANDLE;
         }
         rt_image->destroy();
-        if (!rt_image->create(app.device, window_size))
+        if (!rt_image->create(app.device, trace_size))
+            return false;
+        guide_image->destroy();
+        if (!guide_image->create(app.device, trace_size))
+            return false;
+        resolved_image->destroy();
+        if (!resolved_image->create(app.device, trace_size))
+            return false;
+        history_image->destroy();
+        if (!history_image->create(app.device, trace_size))
+            return false;
+        pilot_image->destroy();
+        if (!pilot_image->create(app.device, trace_size))
+            return false;
+        weight_image->destroy();
+        if (!weight_image->create(app.device, trace_size))
+            return false;
+        upscaled_image->destroy();
+        if (upscaling() && !upscaled_image->create(app.device, window_size))
             return false;
+        for (auto &img : {ssf_depth_image, ssf_thickness_image, ssf_smoothed_image})
+        {
+            img->destroy();
+            if (!img->create(app.device, trace_size))
+                return false;
+        }
+        // the core_wavefront.rgen is part of the pipeline in any case, so the buffers always need a valid (small) binding
+        if (RT_AVAILIBLE && !setup_wavefront_buffers(tracer == TR::wavefront_tracer ? trace_size.x * trace_size.y : 1))
+            return false;
+        reset_history = true;
 
         VkSamplerCreateInfo sampler_info{
             .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
@@ -684,85 +1326,167 @@ namespace fb
         const VkDescriptorImageInfo image_info{.sampler = rt_sampler,
                                                .imageView = rt_image->get_view(),
                                                .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+        const VkDescriptorImageInfo guide_image_info{.imageView = guide_image->get_view(),
+                                                     .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+        const VkDescriptorImageInfo resolved_image_info{.sampler = rt_sampler,
+                                                        .imageView = resolved_image->get_view(),
+                                                        .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+        const VkDescriptorImageInfo pilot_image_info{.imageView = pilot_image->get_view(),
+                                                     .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+        const VkDescriptorImageInfo weight_image_info{.imageView = weight_image->get_view(),
+                                                      .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+        const VkDescriptorImageInfo upscaled_image_info{.sampler = rt_sampler,
+                                                        .imageView = upscaling() ? upscaled_image->get_view() : VK_NULL_HANDLE,
+                                                        .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+        const VkDescriptorImageInfo history_image_info{.sampler = rt_sampler,
+                                                       .imageView = history_image->get_view(),
+                                                       .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
         const VkWriteDescriptorSet write_info{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                                               .dstSet = shared_descriptor_set,
                                               .dstBinding = 1,
                                               .descriptorCount = 1,
                                               .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
                                               .pImageInfo = &image_info};
+        // the blit displays the temporally resolved image (upscaled to the viewport resolution if needed)
         const VkWriteDescriptorSet write_info_sampler{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                                                       .dstSet = shared_descriptor_set,
                                                       .dstBinding = 2,
                                                       .descriptorCount = 1,
                                                       .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                                                      .pImageInfo = &image_info};
-        app.device->vkUpdateDescriptorSets({write_info, write_info_sampler});
+                                                      .pImageInfo = upscaling() ? &upscaled_image_info : &resolved_image_info};
+        const VkWriteDescriptorSet write_info_guide{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                    .dstSet = shared_descriptor_set,
+                                                    .dstBinding = 3,
+                                                    .descriptorCount = 1,
+                                                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                    .pImageInfo = &guide_image_info};
+        const VkWriteDescriptorSet write_info_history{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                      .dstSet = shared_descriptor_set,
+                                                      .dstBinding = 4,
+                                                      .descriptorCount = 1,
+                                                      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                                      .pImageInfo = &history_image_info};
+        const VkWriteDescriptorSet write_info_resolved{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                       .dstSet = shared_descriptor_set,
+                                                       .dstBinding = 5,
+                                                       .descriptorCount = 1,
+                                                       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                       .pImageInfo = &resolved_image_info};
+        const VkWriteDescriptorSet write_info_pilot{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                    .dstSet = shared_descriptor_set,
+                                                    .dstBinding = 6,
+                                                    .descriptorCount = 1,
+                                                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                    .pImageInfo = &pilot_image_info};
+        const VkWriteDescriptorSet write_info_weight{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                     .dstSet = shared_descriptor_set,
+                                                     .dstBinding = 7,
+                                                     .descriptorCount = 1,
+                                                     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                     .pImageInfo = &weight_image_info};
+        app.device->vkUpdateDescriptorSets({write_info, write_info_sampler, write_info_guide, write_info_history, write_info_resolved,
+                                            write_info_pilot, write_info_weight});
+
+        const VkDescriptorImageInfo ssf_image_infos[] = {
+            {.imageView = ssf_depth_image->get_view(), .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+            {.imageView = ssf_thickness_image->get_view(), .imageLayout = VK_IMAGE_LAYOUT_GENERAL},
+            {.imageView = ssf_smoothed_image->get_view(), .imageLayout = VK_IMAGE_LAYOUT_GENERAL}};
+        const VkWriteDescriptorSet write_info_ssf{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                  .dstSet = shared_descriptor_set,
+                                                  .dstBinding = 15,
+                                                  .descriptorCount = 3,
+                                                  .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                  .pImageInfo = ssf_image_infos};
+        app.device->vkUpdateDescriptorSets({write_info_ssf});
+        if (upscaling())
+        {
+            const VkWriteDescriptorSet write_info_upscaled{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                           .dstSet = shared_descriptor_set,
+                                                           .dstBinding = 9,
+                                                           .descriptorCount = 1,
+                                                           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                                           .pImageInfo = &upscaled_image_info};
+            app.device->vkUpdateDescriptorSets({write_info_upscaled});
+        }
 
         return one_time_submit(
             app.device, app.device->graphics_queue(), [&](VkCommandBuffer cmd_buf)
-            { insert_image_memory_barrier(app.device, cmd_buf, rt_image->get(), 0, VK_ACCESS_SHADER_WRITE_BIT,
-                                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
-                                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                                          VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
-                                          rt_image->get_subresource_range()); });
+            {
+                std::vector images{rt_image, guide_image, resolved_image, history_image, pilot_image, weight_image,
+                                   ssf_depth_image, ssf_thickness_image, ssf_smoothed_image};
+                if (upscaling())
+                    images.push_back(upscaled_image);
+                for (auto &img : images)
+                {
+                    insert_image_memory_barrier(app.device, cmd_buf, img->get(), 0, VK_ACCESS_SHADER_WRITE_BIT,
+                                                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                                img->get_subresource_range());
+                }
+            });
     }
 
-    bool core::on_swapchain_create()
+    bool core::setup_wavefront_buffers(uint32_t ray_count)
     {
-        log()->debug("on_swapchain_create");
-        auto render_pass = app.shading.get_pass();
-
-        ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        blit_pipeline = render_pipeline::make(app.device, app.pipeline_cache);
+        if (wavefront_ray_buffer)
+        {
+            wavefront_ray_buffer->destroy();
+            wavefront_queue_buffer->destroy();
+        }
 
-        if (!blit_pipeline->add_shader(app.producer.get_shader("blit.vert"), VK_SHADER_STAGE_VERTEX_BIT))
+        wavefront_ray_buffer = buffer::make();
+        if (!wavefront_ray_buffer->create(app.device, nullptr, ray_count * WAVEFRONT_RAY_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
             return false;
-        if (!blit_pipeline->add_shader(app.producer.get_shader("blit.frag"), VK_SHADER_STAGE_FRAGMENT_BIT))
+        wavefront_queue_buffer = buffer::make();
+        if (!wavefront_queue_buffer->create(app.device, nullptr, 2 * ray_count * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
             return false;
+        wavefront_allocated = tracer == TR::wavefront_tracer;
+
+        app.device->vkUpdateDescriptorSets({VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                                 .dstSet = shared_descriptor_set,
+                                                                 .dstBinding = 10,
+                                                                 .descriptorCount = 1,
+                                                                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                                 .pBufferInfo = wavefront_ray_buffer->get_descriptor_info()},
+                                            VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                                                 .dstSet = shared_descriptor_set,
+                                                                 .dstBinding = 11,
+                                                                 .descriptorCount = 1,
+                                                                 .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                                                 .pBufferInfo = wavefront_queue_buffer->get_descriptor_info()}});
+        return true;
+    }
 
-        blit_pipeline->add_color_blend_attachment();
-        blit_pipeline->set_layout(blit_pipeline_layout);
+    bool core::on_swapchain_create()
+    {
+        log()->debug("on_swapchain_create");
+        auto render_pass = app.shading.get_pass();
 
-        if (!blit_pipeline->create(render_pass->get()))
+        if (!create_render_pipelines(render_pass->get()))
             return false;
+        add_render_pipelines(render_pass);
 
-        if (RT_AVAILIBLE)
-        {
-            blit_pipeline->on_process = [&](VkCommandBuffer cmd_buf)
-            {
-                if (disable_rt)
-                    return;
-
-                const uint32_t uniform_offset = app.block.get_current_frame() * uniform_stride;
-                blit_pipeline_layout->bind_descriptor_set(cmd_buf, shared_descriptor_set, 0, {uniform_offset});
-                vkCmdDraw(cmd_buf, 3, 1, 0, 0);
-            };
-        }
+        cam.set_window(app.window.get());
+        return true;
+    }
 
+    // sets the on_process callbacks and adds the pipelines to the render pass (drawn blit, raster, point cloud)
+    void core::add_render_pipelines(const render_pass::ptr &render_pass)
+    {
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        raster_pipeline = render_pipeline::make(app.device, app.pipeline_cache);
-
-        if (!raster_pipeline->add_shader(app.producer.get_shader("raster.vert"), VK_SHADER_STAGE_VERTEX_BIT))
-            return false;
-        if (!raster_pipeline->add_shader(app.producer.get_shader("raster.frag"), VK_SHADER_STAGE_FRAGMENT_BIT))
-            return false;
-
-        raster_pipeline->add_color_blend_attachment();
-        raster_pipeline->set_layout(raster_pipeline_layout);
-        raster_pipeline->set_rasterization_polygon_mode(VK_POLYGON_MODE_LINE);
-
-        raster_pipeline->set_vertex_input_binding({0, sizeof(vert), VK_VERTEX_INPUT_RATE_VERTEX});
-        raster_pipeline->set_vertex_input_attributes({
-            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, to_ui32(offsetof(vert, position))},
-            {1, 0, VK_FORMAT_R32G32B32_SFLOAT, to_ui32(offsetof(vert, normal))},
-        });
-
-        raster_pipeline->set_depth_test_and_write();
-        raster_pipeline->set_depth_compare_op(VK_COMPARE_OP_LESS_OR_EQUAL);
+        blit_pipeline->on_process = [&](VkCommandBuffer cmd_buf)
+        {
+            // the tracers and the screen space fluid both end in the resolved (or upscaled) image
+            if ((!RT_AVAILIBLE || disable_rt) && !screen_space_fluid)
+                return;
 
-        if (!raster_pipeline->create(render_pass->get()))
-            return false;
+            const uint32_t uniform_offset = app.block.get_current_frame() * uniform_stride;
+            blit_pipeline_layout->bind_descriptor_set(cmd_buf, shared_descriptor_set, 0, {uniform_offset});
+            vkCmdDraw(cmd_buf, 3, 1, 0, 0);
+        };
 
+        ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         raster_pipeline->on_process = [&](VkCommandBuffer cmd_buf)
         {
             if (!overlay_raster)
@@ -771,53 +1495,54 @@ namespace fb
             const uint32_t uniform_offset = app.block.get_current_frame() * uniform_stride;
             raster_pipeline_layout->bind_descriptor_set(cmd_buf, shared_descriptor_set, 0, {uniform_offset});
 
-            std::vector<scene_node *> node_stack{&active_scene->nodes.at(0)};
+            // the draws were flattened from the scene in update_raster_draws, recording does not depend on the scene size
+            const uint32_t frame = app.block.get_current_frame();
+            const raster_slice &slice = raster_slices[frame];
+            const VkDeviceSize command_offset = VkDeviceSize(frame) * MAX_RASTER_DRAWS * sizeof(VkDrawIndexedIndirectCommand);
 
-            while (!node_stack.empty())
+            if (slice.static_draw_count > 0)
             {
-                auto &node = *node_stack.back();
-                node_stack.pop_back();
-                for (auto &child_id : node.children)
+                static_mesh_arena->bind(cmd_buf);
+                const auto &features = app.device->get_features();
+                if (features.drawIndirectFirstInstance)
                 {
-                    scene_node &child = active_scene->nodes.at(child_id);
-
-                    if (child.type == mesh)
+                    // the first instance of every command is its transform index
+                    const uint32_t first_transform = 0;
+                    vkCmdPushConstants(cmd_buf, raster_pipeline_layout->get(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &first_transform);
+                    if (features.multiDrawIndirect)
                     {
-                        vkCmdPushConstants(cmd_buf,
-                                           raster_pipeline_layout->get(),
-                                           VK_SHADER_STAGE_VERTEX_BIT,
-                                           0, sizeof(glm::mat4),
-                                           glm::value_ptr(child.accumulated_transform));
-
-                        meshes[child.payload.mesh.mesh_index]->bind_draw(cmd_buf);
+                        vkCmdDrawIndexedIndirect(cmd_buf, raster_command_buffer->get(), command_offset, slice.static_draw_count,
+                                                 sizeof(VkDrawIndexedIndirectCommand));
                     }
-
-                    if (!child.children.empty())
+                    else
+                    {
+                        for (uint32_t i = 0; i < slice.static_draw_count; ++i)
+                            vkCmdDrawIndexedIndirect(cmd_buf, raster_command_buffer->get(),
+                                                     command_offset + i * sizeof(VkDrawIndexedIndirectCommand), 1,
+                                                     sizeof(VkDrawIndexedIndirectCommand));
+                    }
+                }
+                else
+                {
+                    for (uint32_t i = 0; i < slice.static_draw_count; ++i)
                     {
-                        node_stack.emplace_back(&child);
+                        vkCmdPushConstants(cmd_buf, raster_pipeline_layout->get(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t),
+                                           &slice.static_transform_indices[i]);
+                        vkCmdDrawIndexedIndirect(cmd_buf, raster_command_buffer->get(),
+                                                 command_offset + i * sizeof(VkDrawIndexedIndirectCommand), 1,
+                                                 sizeof(VkDrawIndexedIndirectCommand));
                     }
                 }
             }
+
+            for (const auto &[mesh_index, transform_index] : slice.dynamic_draws)
+            {
+                vkCmdPushConstants(cmd_buf, raster_pipeline_layout->get(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &transform_index);
+                meshes[mesh_index]->bind_draw(cmd_buf);
+            }
         };
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        point_cloud_pipeline = render_pipeline::make(app.device, app.pipeline_cache);
-
-        if (!point_cloud_pipeline->add_shader(app.producer.get_shader("point.vert"), VK_SHADER_STAGE_VERTEX_BIT))
-            return false;
-        if (!point_cloud_pipeline->add_shader(app.producer.get_shader("point.frag"), VK_SHADER_STAGE_FRAGMENT_BIT))
-            return false;
-
-        point_cloud_pipeline->add_color_blend_attachment();
-        point_cloud_pipeline->set_layout(point_cloud_pipeline_layout);
-
-        point_cloud_pipeline->set_depth_test_and_write();
-        point_cloud_pipeline->set_depth_compare_op(VK_COMPARE_OP_LESS_OR_EQUAL);
-        point_cloud_pipeline->set_input_topology(VK_PRIMITIVE_TOPOLOGY_POINT_LIST);
-
-        if (!point_cloud_pipeline->create(render_pass->get()))
-            return false;
-
         point_cloud_pipeline->on_process = [&](VkCommandBuffer cmd_buf)
         {
             if (!render_point_cloud)
@@ -834,16 +1559,14 @@ namespace fb
                                                              {particle_head_grid_read_offset, particle_memory_read_offset,
                                                               particle_head_grid_write_offset, particle_memory_write_offset});
 
-            vkCmdDraw(cmd_buf, MAX_PARTICLES, 1, 0, 0);
+            // one impostor quad per visible particle, the instance count comes from point_cull.comp
+            vkCmdDrawIndirect(cmd_buf, point_draw_buffer->get(), 0, 1, sizeof(VkDrawIndirectCommand));
         };
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
         render_pass->add_front(point_cloud_pipeline);
         render_pass->add_front(raster_pipeline);
         render_pass->add_front(blit_pipeline);
-
-        cam.set_window(app.window.get());
-        return true;
     }
 
     void core::on_swapchain_destroy()
@@ -855,6 +1578,15 @@ namespace fb
             rt_sampler = VK_NULL_HANDLE;
         }
         rt_image->destroy();
+        guide_image->destroy();
+        resolved_image->destroy();
+        history_image->destroy();
+        pilot_image->destroy();
+        weight_image->destroy();
+        upscaled_image->destroy();
+        ssf_depth_image->destroy();
+        ssf_thickness_image->destroy();
+        ssf_smoothed_image->destroy();
         blit_pipeline->destroy();
         raster_pipeline->destroy();
     }
@@ -862,6 +1594,8 @@ namespace fb
     bool core::on_update(float dt)
     {
         limit_fps(dt);
+        if (shader_watch)
+            watch_shaders(dt);
 
         uniforms.time += dt;
         bool imgui_capture_keys = app.imgui.capture_keyboard();
@@ -889,8 +1623,32 @@ namespace fb
         cam.update_cam(dt, imgui_capture_keys);
 
         auto view = cam.getView();
+        uniforms.last_proj_view = uniforms.proj_view;
         uniforms.inv_view = glm::inverse(view);
         uniforms.proj_view = glm::inverse(uniforms.inv_proj) * view;
+
+        if (render_scale != applied_render_scale || (RT_AVAILIBLE && wavefront_allocated != (tracer == TR::wavefront_tracer)))
+        {
+            app.device->wait_for_idle();
+            if (!setup_render_targets())
+                return false;
+        }
+
+        uniforms.temporal.reset = reset_history;
+        uniforms.temporal.frame_index++;
+        reset_history = false;
+
+        switch (fluid_render_mode)
+        {
+        case FR::density_field:
+            uniforms.rendering.cull_mask = IM::scene_instances | IM::fluid_density_instance;
+            break;
+        case FR::particle_spheres:
+            uniforms.rendering.cull_mask = IM::scene_instances | IM::fluid_particle_instance;
+            break;
+        default:
+            uniforms.rendering.cull_mask = IM::scene_instances | IM::fluid_surface_instance;
+        }
         return true;
     }
 
@@ -1057,6 +1815,7 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
             }
             vkCmdDispatch(cmd_buf, 1 + ((MAX_PARTICLES - 1) / 256), 1, 1);
 
+            live_particle_count = std::min(uint32_t(uniforms.sim.reset_num_particles), MAX_PARTICLES);
             initialize_particles = false;
         }
         else if (sim_run || sim_step)
@@ -1096,7 +1855,11 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
     {
         const uint32_t uniform_offset = frame * uniform_stride;
         char *address = static_cast<char *>(uniform_buffer->get_mapped_data()) + uniform_offset;
-        *reinterpret_cast<uniform_data *>(address) = uniforms;
+        auto &frame_uniforms = *reinterpret_cast<uniform_data *>(address);
+        frame_uniforms = uniforms;
+        // the last simulation submission is done (main waits for its fence), so the stream may refill the slots it read;
+        // until the frames at the cursor are uploaded the simulation keeps the last resident ones
+        frame_uniforms.sim.force_field_animation_index = force_field->update(uniforms.sim.force_field_animation_index);
 
         const uint32_t particle_head_grid_read_offset = particle_read_slice_index * particle_head_grid_stride;
         const uint32_t particle_memory_read_offset = particle_read_slice_index * particle_memory_stride;
@@ -1113,7 +1876,13 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
                                        particle_head_grid_write_offset, particle_memory_write_offset},
                                       VK_PIPELINE_BIND_POINT_COMPUTE);
 
-        if ((RT_AVAILIBLE && !disable_rt) || overlay_raster)
+        const bool trace = RT_AVAILIBLE && !disable_rt;
+        const bool extract_surface = (trace && fluid_render_mode == FR::marching_cubes) || overlay_raster;
+        const bool march_density = trace && fluid_render_mode == FR::density_field;
+        const bool trace_particles = trace && fluid_render_mode == FR::particle_spheres;
+        const bool screen_space = screen_space_fluid && !trace;
+
+        if (extract_surface || march_density)
         {
             lava::begin_label(cmd_buf, "calc_density_geo_reset", glm::vec4(0, 0, 1, 0));
 
@@ -1130,8 +1899,11 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
             auto density_calc_work_group_side_count = 1 + ((SIDE_VOXEL_COUNT - 1) / 4);
             vkCmdDispatch(cmd_buf, density_calc_work_group_side_count, density_calc_work_group_side_count, density_calc_work_group_side_count);
 
-            const auto &vertex_buffer = get_named_mesh("fluid")->get_vertex_buffer();
-            vkCmdFillBuffer(cmd_buf, vertex_buffer->get(), 0, VK_WHOLE_SIZE, 0xFFFFFFFF); // 4294967295 -1 nan
+            if (extract_surface)
+            {
+                const auto &vertex_buffer = get_named_mesh("fluid")->get_vertex_buffer();
+                vkCmdFillBuffer(cmd_buf, vertex_buffer->get(), 0, VK_WHOLE_SIZE, 0xFFFFFFFF); // 4294967295 -1 nan
+            }
 
             memory_barrier = VkMemoryBarrier{
                 .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
@@ -1143,13 +1915,16 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
                                  0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
 
             lava::end_label(cmd_buf);
+        }
 
+        if (extract_surface)
+        {
             lava::begin_label(cmd_buf, "iso_extract", glm::vec4(0, 1, 0, 0));
 
             compute_pipelines[CP::iso_extract]->bind(cmd_buf);
             vkCmdDispatch(cmd_buf, SIDE_CUBE_GROUP_COUNT, SIDE_CUBE_GROUP_COUNT, SIDE_CUBE_GROUP_COUNT);
 
-            memory_barrier = VkMemoryBarrier{
+            auto memory_barrier = VkMemoryBarrier{
                 .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
                 .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT,
                 .dstAccessMask = VkAccessFlagBits::VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR};
@@ -1160,43 +1935,618 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
 
             lava::end_label(cmd_buf);
         }
+
+        if (march_density)
+        {
+            lava::begin_label(cmd_buf, "density_blocks", glm::vec4(0, 1, 1, 0));
+
+            compute_pipelines[CP::density_blocks]->bind(cmd_buf);
+            auto density_block_work_group_side_count = 1 + ((SIDE_CUBE_GROUP_COUNT - 1) / 4);
+            vkCmdDispatch(cmd_buf, density_block_work_group_side_count, density_block_work_group_side_count, density_block_work_group_side_count);
+
+            // the block aabbs are read by the blas build, the densities by the intersection shader (or core_query.comp)
+            auto memory_barrier = VkMemoryBarrier{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VkAccessFlagBits::VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT};
+            vkCmdPipelineBarrier(cmd_buf,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+            lava::end_label(cmd_buf);
+        }
+
+        if (trace_particles)
+        {
+            lava::begin_label(cmd_buf, "particle_aabbs", glm::vec4(1, 1, 0, 0));
+
+            // the last trace may still read the aabbs in the intersection shader (or core_query.comp)
+            auto memory_barrier = VkMemoryBarrier{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT,
+                .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT};
+            vkCmdPipelineBarrier(cmd_buf,
+                                 VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+            compute_pipelines[CP::particle_aabbs]->bind(cmd_buf);
+            vkCmdDispatch(cmd_buf, 1 + ((MAX_PARTICLES - 1) / 256), 1, 1);
+
+            memory_barrier = VkMemoryBarrier{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VkAccessFlagBits::VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT};
+            vkCmdPipelineBarrier(cmd_buf,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+            lava::end_label(cmd_buf);
+        }
+
+        if (render_point_cloud || screen_space)
+        {
+            lava::begin_label(cmd_buf, "point_cull", glm::vec4(1, 0, 1, 0));
+
+            // graphics submission: the point buffers are not shared with the async compute queue (see setup_buffers);
+            // the last frame may still draw or splat the points
+            auto memory_barrier = VkMemoryBarrier{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT};
+            vkCmdPipelineBarrier(cmd_buf,
+                                 VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+            vkCmdFillBuffer(cmd_buf, point_draw_buffer->get(), 0, VK_WHOLE_SIZE, 0);
+
+            memory_barrier = VkMemoryBarrier{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VkAccessFlagBits::VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+            vkCmdPipelineBarrier(cmd_buf,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+            compute_pipelines[CP::point_cull]->bind(cmd_buf);
+            vkCmdDispatch(cmd_buf, 1 + ((MAX_PARTICLES - 1) / 256), 1, 1);
+
+            memory_barrier = VkMemoryBarrier{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT};
+            vkCmdPipelineBarrier(cmd_buf,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+            lava::end_label(cmd_buf);
+        }
         lava::end_label(cmd_buf);
 
         /// Rendering //////////////////////////////////////////////////////////////////////////////////////////////////////
 
         active_scene->prepare_for_rendering();
+        if (overlay_raster)
+            update_raster_draws(frame);
 
-        if (RT_AVAILIBLE && !disable_rt)
+        if (trace)
         {
+            const bool query = tracer == TR::query_tracer;
+            const VkPipelineStageFlags trace_stage = query ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+
+            read_trace_time(frame);
+
+            // the last trace ran in either stage (the tracer can be switched at any frame)
             rtt_extension::rt_helper::wait_last_trace(app.device, cmd_buf);
+            vkCmdPipelineBarrier(cmd_buf,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+            // only the active fluid representation is rebuilt, the other one is masked out by uni.r.cull_mask
+            std::vector<rtt_extension::blas::ptr> frame_blas_list;
+            if (fluid_render_mode == FR::density_field)
+            {
+                frame_blas_list.push_back(density_blas);
+            }
+            else if (fluid_render_mode == FR::particle_spheres)
+            {
+                // the build cost scales with the particle count; slots past the live count are never built
+                particle_blas->ranges[0].primitiveCount = glm::clamp(live_particle_count, 1u, MAX_PARTICLES);
+                frame_blas_list.push_back(particle_blas);
+            }
+            else
+            {
+                // Using indirect acceleration structure building would be nicer, but not worth it
+                // especially because we want to display this number
+                uint32_t historic_vertex_count = *std::max_element(begin(last_compute_return_data.created_vertex_counts),
+                                                                   end(last_compute_return_data.created_vertex_counts));
 
-            // Using indirect acceleration structure building would be nicer, but not worth it
-            // especially because we want to display this number
-            uint32_t historic_vertex_count = *std::max_element(begin(last_compute_return_data.created_vertex_counts),
-                                                               end(last_compute_return_data.created_vertex_counts));
+                // modify geometry to reduce build time
+                int target_primitive_count = int(float(historic_vertex_count) * (1.1f / 3.0f));
+                blas_list[dynamic_meshes_offset]->ranges[0].primitiveCount = glm::clamp(target_primitive_count, 10000, int(MAX_PRIMITIVES));
 
-            // modify geometry to reduce build time
-            int target_primitive_count = int(float(historic_vertex_count) * (1.1f / 3.0f));
-            blas_list[dynamic_meshes_offset]->ranges[0].primitiveCount = glm::clamp(target_primitive_count, 10000, int(MAX_PRIMITIVES));
+                frame_blas_list.assign(begin(blas_list) + dynamic_meshes_offset, end(blas_list));
+            }
 
             std::vector vt{top_as};
-            scratch_buffer = rtt_extension::build_acceleration_structures(app.device, cmd_buf,
-                                                                          begin(blas_list) + dynamic_meshes_offset,
-                                                                          end(blas_list),
-                                                                          begin(vt), end(vt),
-                                                                          scratch_buffer);
+            as_scratch->begin_frame(frame);
+            top_as->begin_frame(frame);
+            rtt_extension::build_acceleration_structures(app.device, cmd_buf,
+                                                         begin(frame_blas_list),
+                                                         end(frame_blas_list),
+                                                         begin(vt), end(vt),
+                                                         *as_scratch);
+
+            if (query)
+            {
+                // same as wait_as_build for the compute stage
+                const VkMemoryBarrier barrier = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR};
+                vkCmdPipelineBarrier(cmd_buf,
+                                     VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     0, 1, &barrier, 0, nullptr, 0, nullptr);
+            }
+            else
+            {
+                rtt_extension::rt_helper::wait_as_build(app.device, cmd_buf);
+            }
+
+            // the trace outputs are read by the compute passes of the last frame
+            for (auto &img : {rt_image, guide_image, pilot_image, weight_image})
+            {
+                insert_image_memory_barrier(app.device, cmd_buf, img->get(),
+                                            VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                                            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, trace_stage,
+                                            img->get_subresource_range());
+            }
+
+            // checkerboard rendering traces every other pixel of each row
+            const uint32_t trace_width = uniforms.temporal.checkerboard ? (uniforms.trace_viewport.z + 1) / 2 : uniforms.trace_viewport.z;
+
+            vkCmdResetQueryPool(cmd_buf, trace_timestamp_pool, 2 * frame, 2);
+            vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, trace_timestamp_pool, 2 * frame);
+
+            if (query)
+            {
+                query_pipeline_layout->bind(cmd_buf, shared_descriptor_set, 0, {uniform_offset}, VK_PIPELINE_BIND_POINT_COMPUTE);
+                query_pipeline_layout->bind(cmd_buf, rt_descriptor_set, 1, {}, VK_PIPELINE_BIND_POINT_COMPUTE);
+
+                trace_with_queries(cmd_buf, trace_width);
+            }
+            else if (tracer == TR::wavefront_tracer)
+            {
+                rt_pipeline_layout->bind_descriptor_set(cmd_buf, shared_descriptor_set, 0, {uniform_offset}, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR);
+                rt_pipeline_layout->bind_descriptor_set(cmd_buf, rt_descriptor_set, 1, {}, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR);
+
+                trace_wavefront(cmd_buf, trace_width);
+            }
+            else
+            {
+                rt_pipeline_layout->bind_descriptor_set(cmd_buf, shared_descriptor_set, 0, {uniform_offset}, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR);
+                rt_pipeline_layout->bind_descriptor_set(cmd_buf, rt_descriptor_set, 1, {}, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR);
+
+                rt_pipeline->bind_and_trace(cmd_buf, trace_width, uniforms.trace_viewport.w, 1, 1); // pilot
 
-            rtt_extension::rt_helper::wait_as_build(app.device, cmd_buf);
+                allocate_samples(cmd_buf);
 
-            rtt_extension::rt_helper::wait_acquire_image(app.device, cmd_buf, *rt_image);
+                rt_pipeline->bind_and_trace(cmd_buf, trace_width, uniforms.trace_viewport.w);
+            }
+
+            vkCmdWriteTimestamp(cmd_buf, trace_stage, trace_timestamp_pool, 2 * frame + 1);
+            trace_timestamps_written[frame] = true;
+
+            resolve_temporal(cmd_buf);
+
+            if (upscaling())
+                upscale(cmd_buf);
+        }
+        else if (screen_space)
+        {
+            render_screen_space_fluid(cmd_buf);
+
+            if (upscaling())
+                upscale(cmd_buf);
+            // the history holds the screen space image, the tracers start over when they are enabled again
+            reset_history = true;
+        }
+    }
+
+    void core::update_raster_draws(uint32_t frame)
+    {
+        raster_slice &slice = raster_slices[frame];
+        if (slice.scene_version == active_scene->get_version())
+            return;
+        slice.scene_version = active_scene->get_version();
+        slice.static_draw_count = 0;
+        slice.static_transform_indices.clear();
+        slice.dynamic_draws.clear();
+
+        const bool first_instance = app.device->get_features().drawIndirectFirstInstance;
+        auto *commands = static_cast<VkDrawIndexedIndirectCommand *>(raster_command_buffer->get_mapped_data()) + frame * MAX_RASTER_DRAWS;
+        auto *transforms = static_cast<glm::mat4 *>(raster_transform_buffer->get_mapped_data());
+
+        uint32_t transform_index = frame * MAX_RASTER_DRAWS;
+        for (const auto &[id, node] : active_scene->nodes)
+        {
+            if (node.type != mesh)
+                continue;
+            if (transform_index == (frame + 1) * MAX_RASTER_DRAWS)
+            {
+                log()->warn("more than {} mesh nodes, the rest is not rasterized", MAX_RASTER_DRAWS);
+                break;
+            }
+
+            const uint32_t mesh_index = node.payload.mesh.mesh_index;
+            transforms[transform_index] = node.accumulated_transform;
+            if (mesh_index >= dynamic_meshes_offset)
+            {
+                slice.dynamic_draws.emplace_back(mesh_index, transform_index++);
+                continue;
+            }
+            if (static_mesh_arena->empty())
+                continue;
+
+            const mesh_arena::range &range = static_mesh_arena->get_range(mesh_index);
+            commands[slice.static_draw_count++] = VkDrawIndexedIndirectCommand{
+                .indexCount = range.index_count,
+                .instanceCount = 1,
+                .firstIndex = range.first_index,
+                .vertexOffset = range.vertex_offset,
+                .firstInstance = first_instance ? transform_index : 0};
+            slice.static_transform_indices.push_back(transform_index++);
+        }
+    }
 
-            rt_pipeline_layout->bind_descriptor_set(cmd_buf, shared_descriptor_set, 0, {uniform_offset}, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR);
-            rt_pipeline_layout->bind_descriptor_set(cmd_buf, rt_descriptor_set, 1, {}, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR);
+    void core::render_screen_space_fluid(VkCommandBuffer cmd_buf)
+    {
+        lava::begin_label(cmd_buf, "screen_space_fluid", glm::vec4(0, 0.5, 1, 0));
 
-            rt_pipeline->bind_and_trace(cmd_buf, uniforms.viewport.z, uniforms.viewport.w);
+        const uint32_t width = uniforms.trace_viewport.z;
+        const uint32_t height = uniforms.trace_viewport.w;
 
-            rtt_extension::rt_helper::wait_release_image(app.device, cmd_buf, *rt_image);
+        // the splat images of the last frame were read by the smoothing and shading
+        for (auto &img : {ssf_depth_image, ssf_thickness_image})
+        {
+            insert_image_memory_barrier(app.device, cmd_buf, img->get(),
+                                        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                        img->get_subresource_range());
+        }
+        const VkClearColorValue empty_depth{.uint32 = {0xffffffff, 0, 0, 0}};
+        const VkClearColorValue no_thickness{.uint32 = {0, 0, 0, 0}};
+        const VkImageSubresourceRange range = ssf_depth_image->get_subresource_range();
+        vkCmdClearColorImage(cmd_buf, ssf_depth_image->get(), VK_IMAGE_LAYOUT_GENERAL, &empty_depth, 1, &range);
+        vkCmdClearColorImage(cmd_buf, ssf_thickness_image->get(), VK_IMAGE_LAYOUT_GENERAL, &no_thickness, 1, &range);
+        for (auto &img : {ssf_depth_image, ssf_thickness_image})
+        {
+            insert_image_memory_barrier(app.device, cmd_buf, img->get(),
+                                        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                        img->get_subresource_range());
+        }
+
+        compute_pipelines[CP::ssf_splat]->bind(cmd_buf);
+        vkCmdDispatch(cmd_buf, 1 + ((MAX_PARTICLES - 1) / 64), 1, 1);
+
+        insert_image_memory_barrier(app.device, cmd_buf, ssf_depth_image->get(),
+                                    VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    ssf_depth_image->get_subresource_range());
+
+        compute_pipelines[CP::ssf_smooth]->bind(cmd_buf);
+        vkCmdDispatch(cmd_buf, 1 + ((width - 1) / 8), 1 + ((height - 1) / 8), 1);
+
+        for (auto &img : {ssf_thickness_image, ssf_smoothed_image})
+        {
+            insert_image_memory_barrier(app.device, cmd_buf, img->get(),
+                                        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                        img->get_subresource_range());
         }
+        // the resolved image of the last frame was read by the blit or upscale
+        insert_image_memory_barrier(app.device, cmd_buf, resolved_image->get(),
+                                    VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    resolved_image->get_subresource_range());
+
+        compute_pipelines[CP::ssf_shade]->bind(cmd_buf);
+        vkCmdDispatch(cmd_buf, 1 + ((width - 1) / 8), 1 + ((height - 1) / 8), 1);
+
+        for (auto &img : {resolved_image, guide_image})
+        {
+            insert_image_memory_barrier(app.device, cmd_buf, img->get(),
+                                        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                        img->get_subresource_range());
+        }
+
+        lava::end_label(cmd_buf);
+    }
+
+    void core::trace_with_queries(VkCommandBuffer cmd_buf, uint32_t trace_width)
+    {
+        lava::begin_label(cmd_buf, "trace_query", glm::vec4(1, 0.5, 0, 0));
+
+        // the tile counter of the last frame was incremented by core_query.comp
+        auto memory_barrier = VkMemoryBarrier{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VkAccessFlagBits::VK_ACCESS_TRANSFER_WRITE_BIT};
+        vkCmdPipelineBarrier(cmd_buf,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+        vkCmdFillBuffer(cmd_buf, query_tile_buffer->get(), 0, VK_WHOLE_SIZE, 0);
+
+        memory_barrier = VkMemoryBarrier{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VkAccessFlagBits::VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+        vkCmdPipelineBarrier(cmd_buf,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+        // persistent work groups; only as many as needed to fill the gpu, the rest of the tiles is pulled from the queue
+        const uint32_t tile_count = (1 + ((trace_width - 1) / 8)) * (1 + ((uniforms.trace_viewport.w - 1) / 8));
+        query_pipeline->bind(cmd_buf);
+        vkCmdDispatch(cmd_buf, std::min(tile_count, MAX_QUERY_WORK_GROUPS), 1, 1);
+
+        // trace outputs are read by the temporal resolve
+        memory_barrier = VkMemoryBarrier{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT};
+        vkCmdPipelineBarrier(cmd_buf,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+        lava::end_label(cmd_buf);
+    }
+
+    void core::trace_wavefront(VkCommandBuffer cmd_buf, uint32_t trace_width)
+    {
+        lava::begin_label(cmd_buf, "trace_wavefront", glm::vec4(1, 0.5, 0, 0));
+
+        const uint32_t launch_count = trace_width * uniforms.trace_viewport.w;
+        const VkDeviceAddress command_address = wavefront_command_buffer->get_address();
+
+        for (uint32_t sample = 0; sample < uint32_t(uniforms.rendering.spp); sample++)
+        {
+            // the paths and queues of the last sample (or frame) are still read by the last passes
+            auto memory_barrier = VkMemoryBarrier{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+            vkCmdPipelineBarrier(cmd_buf,
+                                 VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+            wavefront_constants constants{.bounce = 0, .sample_index = sample};
+            vkCmdPushConstants(cmd_buf, compute_pipeline_layout->get(), VK_SHADER_STAGE_COMPUTE_BIT,
+                               0, sizeof(wavefront_constants), &constants);
+            compute_pipelines[CP::wavefront_generate]->bind(cmd_buf);
+            vkCmdDispatch(cmd_buf, 1 + ((launch_count - 1) / 256), 1, 1);
+
+            for (uint32_t bounce = 0; bounce <= uint32_t(uniforms.rendering.max_secondary_ray_count); bounce++)
+            {
+                constants.bounce = bounce;
+
+                // queue + launch command written by the generation or the compaction
+                memory_barrier = VkMemoryBarrier{
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT,
+                    .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT};
+                vkCmdPipelineBarrier(cmd_buf,
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                                     0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+                vkCmdPushConstants(cmd_buf, rt_pipeline_layout->get(), VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+                                   0, sizeof(wavefront_constants), &constants);
+                rt_pipeline->bind_and_trace_indirect(cmd_buf, command_address + (bounce & 1) * 4 * sizeof(uint32_t), 2);
+
+                // the last bounce finishes all paths
+                if (bounce == uint32_t(uniforms.rendering.max_secondary_ray_count))
+                    break;
+
+                // the output queue length was the launch width of the previous bounce
+                memory_barrier = VkMemoryBarrier{
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                    .dstAccessMask = VkAccessFlagBits::VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+                vkCmdPipelineBarrier(cmd_buf,
+                                     VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                                     VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                     0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+                vkCmdFillBuffer(cmd_buf, wavefront_command_buffer->get(), ((bounce + 1) & 1) * 4 * sizeof(uint32_t), sizeof(uint32_t), 0);
+
+                memory_barrier = VkMemoryBarrier{
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VkAccessFlagBits::VK_ACCESS_TRANSFER_WRITE_BIT,
+                    .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+                vkCmdPipelineBarrier(cmd_buf,
+                                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+                vkCmdPushConstants(cmd_buf, compute_pipeline_layout->get(), VK_SHADER_STAGE_COMPUTE_BIT,
+                                   0, sizeof(wavefront_constants), &constants);
+                compute_pipelines[CP::wavefront_compact]->bind(cmd_buf);
+                vkCmdDispatch(cmd_buf, 1 + ((launch_count - 1) / 256), 1, 1);
+            }
+        }
+
+        lava::end_label(cmd_buf);
+    }
+
+    void core::read_trace_time(uint32_t frame)
+    {
+        // the command buffer of this frame finished, so its timestamps are available (if it traced at all)
+        if (!trace_timestamps_written[frame])
+            return;
+
+        std::array<uint64_t, 2> timestamps{};
+        if (vkGetQueryPoolResults(app.device->get(), trace_timestamp_pool, 2 * frame, 2,
+                                  sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+            return;
+
+        const float period = app.device->get_physical_device()->get_properties().limits.timestampPeriod;
+        const float ms = float(timestamps[1] - timestamps[0]) * period * 1e-6f;
+        trace_time_ms = glm::mix(trace_time_ms, ms, 0.05f);
+    }
+
+    void core::allocate_samples(VkCommandBuffer cmd_buf)
+    {
+        lava::begin_label(cmd_buf, "sample_allocation", glm::vec4(0, 1, 1, 0));
+
+        insert_image_memory_barrier(app.device, cmd_buf, pilot_image->get(),
+                                    VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                    pilot_image->get_subresource_range());
+
+        // the weight sum of the last frame was read by the main trace
+        auto memory_barrier = VkMemoryBarrier{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT,
+            .dstAccessMask = VkAccessFlagBits::VK_ACCESS_TRANSFER_WRITE_BIT};
+        vkCmdPipelineBarrier(cmd_buf,
+                             VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+        vkCmdFillBuffer(cmd_buf, sample_allocation_buffer->get(), 0, VK_WHOLE_SIZE, 0);
+
+        memory_barrier = VkMemoryBarrier{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VkAccessFlagBits::VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+        vkCmdPipelineBarrier(cmd_buf,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+        compute_pipelines[CP::sample_allocation]->bind(cmd_buf);
+        vkCmdDispatch(cmd_buf, 1 + ((uniforms.trace_viewport.z - 1) / 8), 1 + ((uniforms.trace_viewport.w - 1) / 8), 1);
+
+        // weights and their sum are read by the main trace
+        memory_barrier = VkMemoryBarrier{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VkAccessFlagBits::VK_ACCESS_SHADER_READ_BIT};
+        vkCmdPipelineBarrier(cmd_buf,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                             0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+        lava::end_label(cmd_buf);
+    }
+
+    void core::resolve_temporal(VkCommandBuffer cmd_buf)
+    {
+        lava::begin_label(cmd_buf, "temporal_resolve", glm::vec4(1, 0, 1, 0));
+
+        for (auto &img : {rt_image, guide_image})
+        {
+            insert_image_memory_barrier(app.device, cmd_buf, img->get(),
+                                        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                        img->get_subresource_range());
+        }
+        // the resolved image of the last frame was read by the blit or upscale and the history copy
+        insert_image_memory_barrier(app.device, cmd_buf, resolved_image->get(),
+                                    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    resolved_image->get_subresource_range());
+
+        compute_pipelines[CP::temporal_resolve]->bind(cmd_buf);
+        vkCmdDispatch(cmd_buf, 1 + ((uniforms.trace_viewport.z - 1) / 8), 1 + ((uniforms.trace_viewport.w - 1) / 8), 1);
+
+        insert_image_memory_barrier(app.device, cmd_buf, resolved_image->get(),
+                                    VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                    resolved_image->get_subresource_range());
+        insert_image_memory_barrier(app.device, cmd_buf, history_image->get(),
+                                    VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                    history_image->get_subresource_range());
+
+        const VkImageCopy region{
+            .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            .extent = {uniforms.trace_viewport.z, uniforms.trace_viewport.w, 1}};
+        vkCmdCopyImage(cmd_buf, resolved_image->get(), VK_IMAGE_LAYOUT_GENERAL,
+                       history_image->get(), VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+
+        insert_image_memory_barrier(app.device, cmd_buf, history_image->get(),
+                                    VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    history_image->get_subresource_range());
+
+        lava::end_label(cmd_buf);
+    }
+
+    void core::upscale(VkCommandBuffer cmd_buf)
+    {
+        lava::begin_label(cmd_buf, "upscale", glm::vec4(0, 0, 1, 0));
+
+        // the upscaled image of the last frame was read by the blit
+        insert_image_memory_barrier(app.device, cmd_buf, upscaled_image->get(),
+                                    VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                    upscaled_image->get_subresource_range());
+
+        compute_pipelines[CP::upscale]->bind(cmd_buf);
+        vkCmdDispatch(cmd_buf, 1 + ((uniforms.viewport.z - 1) / 8), 1 + ((uniforms.viewport.w - 1) / 8), 1);
+
+        insert_image_memory_barrier(app.device, cmd_buf, upscaled_image->get(),
+                                    VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                    upscaled_image->get_subresource_range());
+
+        lava::end_label(cmd_buf);
     }
 
     void core::on_imgui(uint32_t frame)
@@ -1261,6 +2611,8 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
 
             ImGui::Checkbox("Animate force field",&animate_force_field);
             TOOLTIP("Animate the force field (time is real time)(space -> play/pause)");
+            ImGui::Text("Resident frames: %u of %u", force_field->get_resident_count(), force_field_animation_frames);
+            TOOLTIP("Frames uploaded to the gpu; the ones ahead of the cursor are streamed from the mapped file");
 
             ImGui::TreePop();
         }
@@ -1336,13 +2688,66 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
 
             ImGui::Checkbox("Rasterized overlay", &overlay_raster);
             TOOLTIP("Render the mesh as wireframe (color describes normal)");
+            ImGui::Checkbox("Screen space fluid", &screen_space_fluid);
+            TOOLTIP("Splat the particles as spheres, smooth their depth and shade the surface (only while nothing is traced)");
+            if (screen_space_fluid)
+            {
+                ImGui::SliderFloat("Sphere radius", &rendering.ssf_radius_scale, 0.1f, 2.0f);
+                TOOLTIP("Splatted sphere radius relative to the kernel radius");
+                ImGui::SliderFloat("Smoothing radius", &rendering.ssf_filter_radius, 0.0f, 6.0f);
+                TOOLTIP("Depth filter radius in sphere radii");
+                ImGui::SliderFloat("Smoothing depth range", &rendering.ssf_depth_falloff, 0.1f, 4.0f);
+                TOOLTIP("Depth differences (in sphere radii) beyond which neighbours stop being smoothed in");
+            }
             ImGui::Checkbox("Render point cloud", &render_point_cloud);
-            TOOLTIP("Render each particle as a single pixel the color describes the density (low->high; red->green->blue)");
+            TOOLTIP("Render each particle as a small sphere the color describes the density (low->high; red->green->blue)");
+            if (render_point_cloud)
+            {
+                ImGui::SliderFloat("Point radius", &rendering.point_radius_scale, 0.01f, 1.0f);
+                TOOLTIP("Sphere radius relative to the kernel radius, far spheres keep at least one pixel");
+            }
 
             if (RT_AVAILIBLE)
             {
+                ImGui::Combo("Fluid representation", &fluid_render_mode, "Marching cubes mesh\0Density field\0Particle spheres\0");
+                TOOLTIP("Marching cubes: trace the extracted triangle mesh\n"
+                        "Density field: ray march the density grid inside the blocks containing the surface (no mesh extraction)\n"
+                        "Particle spheres: trace each particle as a sphere with the mesh generation kernel radius (quick look)");
+                ImGui::Combo("Tracer", &tracer, "Ray tracing pipeline\0Ray query compute\0Wavefront\0");
+                if (tracer == TR::query_tracer && !RAY_QUERY_AVAILIBLE)
+                    tracer = TR::pipeline_tracer;
+                TOOLTIP("Ray tracing pipeline: one ray generation invocation follows the whole path (with adaptive sampling)\n"
+                        "Ray query compute: the same path tracer inline in a compute shader with persistent work groups\n"
+                        "(needs VK_KHR_ray_query)\n"
+                        "Wavefront: one indirect trace per bounce over the compacted queue of paths still in flight\n"
+                        "The last two use fixed samples per pixel; compare the trace time to pick the fastest one for this gpu");
+                ImGui::Text("Trace time: %.2f ms", trace_time_ms);
+                TOOLTIP("GPU time of the trace passes (smoothed), without acceleration structure builds and temporal resolve");
+                int render_scale_index = int(std::distance(RENDER_SCALES.begin(), std::min_element(
+                    RENDER_SCALES.begin(), RENDER_SCALES.end(),
+                    [&](float a, float b) { return std::abs(a - render_scale) < std::abs(b - render_scale); })));
+                if (ImGui::Combo("Render scale", &render_scale_index, "1.0x\0" "0.75x\0" "0.67x\0" "0.5x\0"))
+                    set_render_scale(RENDER_SCALES[render_scale_index]);
+                TOOLTIP("Trace at a reduced resolution and upscale guided by the normal and depth of the primary hits");
+                ImGui::Checkbox("Checkerboard", &uniforms.temporal.checkerboard);
+                TOOLTIP("Trace half of the pixels each frame and reconstruct the others from the previous frame");
                 ImGui::SliderInt("Samples per pixel", &rendering.spp, 1, 50);
-                TOOLTIP("Amount of rays started at the camera for each pixel");
+                TOOLTIP("Amount of rays started at the camera for each pixel (average with adaptive sampling)");
+                ImGui::Checkbox("Adaptive sampling", &rendering.adaptive_sampling);
+                TOOLTIP("Distribute the sample budget according to the noise of a one sample pilot pass (sky only pixels get a single sample)");
+                ImGui::SliderInt("Max samples per pixel", &rendering.max_adaptive_spp, 1, 128);
+                TOOLTIP("Upper limit of samples a single pixel can get with adaptive sampling");
+                ImGui::SliderFloat("Sky blur per bounce", &rendering.sky_lod_per_bounce, 0.0f, 2.0f);
+                TOOLTIP("Mip level of the prefiltered sky added per surface hit of the path (primary rays see the full resolution sky)\n"
+                        "Secondary rays land on a smoother sky, which reduces noise at low samples per pixel");
+                ImGui::SliderFloat("Max sky blur", &rendering.max_sky_lod, 0.0f, float(sky_box->get_level_count() - 1));
+                TOOLTIP("Highest mip level of the sky used by secondary rays");
+                ImGui::Checkbox("Temporal accumulation", &uniforms.temporal.enabled);
+                TOOLTIP("Blend each frame with the reprojected history of the previous frames");
+                ImGui::SliderFloat("Min blend factor", &uniforms.temporal.min_blend_factor, 0.01f, 1.0f);
+                TOOLTIP("Minimal weight of the current frame (lower -> less noise, more ghosting)");
+                ImGui::SliderFloat("History clamp", &uniforms.temporal.clamp_gamma, 0.5f, 4.0f);
+                TOOLTIP("Max distance of the history to the neighbourhood mean in standard deviations");
                 ImGui::SliderFloat("Index of Refraction", &rendering.ior, 0.25f, 4.0f);
                 TOOLTIP("IOR of the fluid (water 1.3) (air 1); setting it lower simulates the inverse");
                 ImGui::SliderInt("Min secondary ray count", &rendering.min_secondary_ray_count, 0, 32);
@@ -1404,12 +2809,168 @@ void core::on_compute(uint32_t frame, VkCommandBuffer cmd_buf)
 #undef TOOLTIP
     }
 
+    // also called by the pipeline jobs on the workers
+    cdata core::get_shader(const std::string &name)
+    {
+        std::string error;
+        uint64_t key;
+        const auto *spirv = shaders->get(app.props.get_filename(name), error, nullptr, &key);
+        // the key of the sources that were compiled, also if that failed, so only a later edit reloads the shader
+        if (shader_watch && key != 0)
+        {
+            std::lock_guard lock(shader_keys_mutex);
+            shader_keys[name] = key;
+        }
+        if (!spirv)
+        {
+            log()->error("shader {}: {}", name, error);
+            return {};
+        }
+        return {spirv->data(), spirv->size() * sizeof(uint32_t)};
+    }
+
+    // polled from on_update; the key of a shader changes if it or one of its includes was edited
+    void core::watch_shaders(float dt)
+    {
+        shader_watch_timer += dt;
+        if (shader_watch_timer < SHADER_WATCH_INTERVAL)
+            return;
+        shader_watch_timer = 0.0f;
+
+        // edits made while a reload runs are found once it is finished, get_shader records the keys it compiled
+        if (pending_reload)
+        {
+            const bool ready = std::all_of(pending_reload->jobs.begin(), pending_reload->jobs.end(), [](const auto &job)
+                                           { return job.wait_for(std::chrono::seconds(0)) == std::future_status::ready; });
+            if (ready)
+                finish_reload();
+            return;
+        }
+
+        std::unordered_set<std::string> changed;
+        {
+            std::lock_guard lock(shader_keys_mutex);
+            for (auto &[name, key] : shader_keys)
+            {
+                // a file that can't be read right now (editors save in steps) is checked again next time
+                uint64_t current;
+                std::string error;
+                if (shaders->get_key(app.props.get_filename(name), current, error) && current != key)
+                    changed.insert(name);
+            }
+        }
+        if (!changed.empty())
+            reload_pipelines(changed);
+    }
+
+    // Starts recreating the pipelines that use one of the changed shaders. The replacements are created on the workers
+    // while frames go on; watch_shaders polls the jobs and finish_reload swaps in the ones that were created. Buffers,
+    // the particle state and the acceleration structures stay.
+    void core::reload_pipelines(const std::unordered_set<std::string> &changed)
+    {
+        auto uses = [&](std::initializer_list<const char *> names)
+        {
+            return std::any_of(names.begin(), names.end(), [&](const char *name) { return changed.contains(name); });
+        };
+
+        auto reload = std::make_unique<pipeline_reload>();
+        auto *r = reload.get();
+        r->render_pass = app.shading.get_pass()->get();
+        r->compute_pipelines.resize(compute_pipelines.size());
+
+        // the shaders of each pipeline, as used by the create_*_pipeline functions
+        if (RT_AVAILIBLE && uses({"rgen", "rgen_pilot", "rgen_wavefront", "rmiss", "rchit", "rchit_procedural", "rint_density", "rint_particle"}))
+            r->jobs.push_back(workers->submit([this, r] { return (r->rt_pipeline = create_rt_pipeline()) != nullptr; }));
+        if (RAY_QUERY_AVAILIBLE && uses({"core_query"}))
+            r->jobs.push_back(workers->submit([this, r] { return (r->query_pipeline = create_query_pipeline()) != nullptr; }));
+        for (uint32_t index = 0; index < COMPUTE_SHADERS.size(); index++)
+        {
+            if (uses({COMPUTE_SHADERS[index]}))
+                r->jobs.push_back(workers->submit([this, r, index] { return (r->compute_pipelines[index] = create_compute_pipeline(CP(index))) != nullptr; }));
+        }
+        if (uses({"blit.vert", "blit.frag"}))
+            r->jobs.push_back(workers->submit([this, r] { return (r->blit_pipeline = create_blit_pipeline(r->render_pass)) != nullptr; }));
+        if (uses({"raster.vert", "raster.frag"}))
+            r->jobs.push_back(workers->submit([this, r] { return (r->raster_pipeline = create_raster_pipeline(r->render_pass)) != nullptr; }));
+        if (uses({"point.vert", "point.frag"}))
+            r->jobs.push_back(workers->submit([this, r] { return (r->point_cloud_pipeline = create_point_cloud_pipeline(r->render_pass)) != nullptr; }));
+
+        if (!r->jobs.empty())
+            pending_reload = std::move(reload);
+    }
+
+    // Swaps in every replacement of the pending reload that was created (after the device is idle), a pipeline whose
+    // shaders have errors keeps running until they are fixed.
+    void core::finish_reload()
+    {
+        const auto reload = std::move(pending_reload);
+        const size_t pipeline_count = reload->jobs.size();
+        wait_for_jobs(reload->jobs);
+
+        // render pipelines for a render pass that was recreated meanwhile are of no use
+        const auto render_pass = app.shading.get_pass();
+        if (render_pass->get() != reload->render_pass)
+        {
+            for (auto *pipeline : {&reload->blit_pipeline, &reload->raster_pipeline, &reload->point_cloud_pipeline})
+            {
+                if (*pipeline)
+                    (*pipeline)->destroy();
+                pipeline->reset();
+            }
+        }
+
+        size_t replaced = 0;
+        const bool render_pipelines_replaced = reload->blit_pipeline || reload->raster_pipeline || reload->point_cloud_pipeline;
+        if (reload->rt_pipeline || reload->query_pipeline || render_pipelines_replaced ||
+            std::any_of(reload->compute_pipelines.begin(), reload->compute_pipelines.end(), [](const auto &p) { return p != nullptr; }))
+        {
+            app.device->wait_for_idle();
+        }
+        if (render_pipelines_replaced)
+        {
+            render_pass->remove(blit_pipeline);
+            render_pass->remove(raster_pipeline);
+            render_pass->remove(point_cloud_pipeline);
+        }
+
+        // destroys the pipeline the replacement takes the place of
+        auto replace = [&](auto &current, auto &replacement)
+        {
+            if (!replacement)
+                return;
+            std::swap(current, replacement);
+            replacement->destroy();
+            replaced++;
+        };
+
+        replace(rt_pipeline, reload->rt_pipeline);
+        replace(query_pipeline, reload->query_pipeline);
+        for (size_t i = 0; i < compute_pipelines.size(); i++)
+            replace(compute_pipelines[i], reload->compute_pipelines[i]);
+        replace(blit_pipeline, reload->blit_pipeline);
+        replace(raster_pipeline, reload->raster_pipeline);
+        replace(point_cloud_pipeline, reload->point_cloud_pipeline);
+        if (render_pipelines_replaced)
+            add_render_pipelines(render_pass);
+
+        if (replaced == pipeline_count)
+            log()->info("shader reload: recreated {} pipelines", replaced);
+        else
+            log()->error("shader reload: recreated {} of {} pipelines, the others keep their current shaders", replaced, pipeline_count);
+    }
+
     uint64_t core::add_instance(uint32_t mesh_index, const glm::mat4x3 &transform)
     {
         if (!RT_AVAILIBLE)
             return 0;
 
-        auto [ok, id] = top_as->add_instance(*blas_list.at(mesh_index), transform, instance_data{.vertex_buffer = meshes.at(mesh_index)->get_vertex_buffer()->get_address(), .index_buffer = meshes.at(mesh_index)->get_index_buffer()->get_address()});
+        auto mask = mesh_index >= dynamic_meshes_offset ? IM::fluid_surface_instance : IM::scene_instances;
+        const instance_data data = mesh_index >= dynamic_meshes_offset
+                                       ? instance_data{.vertex_buffer = meshes.at(mesh_index)->get_vertex_buffer()->get_address(),
+                                                       .index_buffer = meshes.at(mesh_index)->get_index_buffer()->get_address()}
+                                       : instance_data{.vertex_buffer = static_mesh_arena->get_vertex_address(mesh_index),
+                                                       .index_buffer = static_mesh_arena->get_index_address(mesh_index)};
+        auto [ok, id] = top_as->add_instance(*blas_list.at(mesh_index), transform, data, 0, 0, mask);
         if (ok)
         {
             instance_count++;
@@ -6,8 +6,17 @@
 #include <rtt_extension.hpp>
 #include <liblava/lava.hpp>
 #include "camera.hpp"
+#include "environment_map.hpp"
+#include "force_field_stream.hpp"
+#include "mesh_arena.hpp"
+#include "pipeline_cache.hpp"
 #include "scene.hpp"
+#include "shader_cache.hpp"
+#include "thread_pool.hpp"
 #include "types_and_data.hpp"
+#include <future>
+#include <mutex>
+#include <unordered_set>
 
 namespace fb {
 
@@ -17,7 +26,40 @@ enum CP{
     init_particles,
     sim_particles,
     sim_particles_density,
-    init_particles_lattice
+    init_particles_lattice,
+    density_blocks,
+    particle_aabbs,
+    temporal_resolve,
+    sample_allocation,
+    upscale,
+    wavefront_generate,
+    wavefront_compact,
+    point_cull,
+    ssf_splat,
+    ssf_smooth,
+    ssf_shade
+};
+
+// how the fluid is represented in the ray traced image
+enum FR{
+    marching_cubes,
+    density_field,
+    particle_spheres
+};
+
+// which renderer traces the image; both write the same images (pilot, guide, trace output)
+enum TR{
+    pipeline_tracer,
+    query_tracer,
+    wavefront_tracer
+};
+
+// instance masks; the ray generation shader selects the active fluid representation via the cull mask
+enum IM : uint8_t{
+    scene_instances = 0x1,
+    fluid_surface_instance = 0x2,
+    fluid_density_instance = 0x4,
+    fluid_particle_instance = 0x8
 };
 
 struct alignas(16) temp_debug_struct{
@@ -32,16 +74,35 @@ struct alignas(16) mesh_generation_struct{
     [[maybe_unused]] float kernel_radius;
     [[maybe_unused]] float density_multiplier = 0.7f;
     [[maybe_unused]] float density_threshold = 0.5f;
+    [[maybe_unused]] uint32_t side_voxel_count{};
 };
 
 struct alignas(16) rendering_struct{
     [[maybe_unused]] glm::vec4 fluid_color = {0.7,0.92,0.98,0.0};
     [[maybe_unused]] glm::vec4 floor_color = {0.5,0.2,0.05,0.0};
-    [[maybe_unused]] int spp = 10;
+    [[maybe_unused]] int spp = 2;
     [[maybe_unused]] float ior = 1.3;
     [[maybe_unused]] int max_secondary_ray_count = 16;
     [[maybe_unused]] int min_secondary_ray_count = 2;
     [[maybe_unused]] float secondary_ray_survival_probability = 0.92f;
+    [[maybe_unused]] uint32_t cull_mask = 0xff;
+    [[maybe_unused]] alignas(4) bool adaptive_sampling = true;
+    [[maybe_unused]] int max_adaptive_spp = 32;
+    [[maybe_unused]] float sky_lod_per_bounce = 0.75f;
+    [[maybe_unused]] float max_sky_lod = 4.0f;
+    [[maybe_unused]] float point_radius_scale = 0.25f; // point cloud impostor radius relative to the kernel radius
+    [[maybe_unused]] float ssf_radius_scale = 0.6f; // screen space fluid sphere radius relative to the kernel radius
+    [[maybe_unused]] float ssf_filter_radius = 2.5f; // in sphere radii
+    [[maybe_unused]] float ssf_depth_falloff = 1.0f; // in sphere radii
+};
+
+struct alignas(16) temporal_struct{
+    [[maybe_unused]] alignas(4) bool enabled = true;
+    [[maybe_unused]] float min_blend_factor = 0.05f;
+    [[maybe_unused]] float clamp_gamma = 1.25f;
+    [[maybe_unused]] alignas(4) bool reset = true;
+    [[maybe_unused]] uint32_t frame_index{};
+    [[maybe_unused]] alignas(4) bool checkerboard = false;
 };
 
 struct alignas(16) simulation_struct{
@@ -84,8 +145,10 @@ struct alignas(16) uniform_data {
     [[maybe_unused]] glm::mat4 inv_view;
     [[maybe_unused]] glm::mat4 inv_proj;
     [[maybe_unused]] glm::mat4 proj_view;
+    [[maybe_unused]] glm::mat4 last_proj_view;
     [[maybe_unused]] glm::mat4 fluid_model;
     [[maybe_unused]] glm::uvec4 viewport;
+    [[maybe_unused]] glm::uvec4 trace_viewport;
     [[maybe_unused]] glm::vec4 background_color;
     [[maybe_unused]] float time;
     [[maybe_unused]] int swapchain_frame;
@@ -96,7 +159,7 @@ struct alignas(16) uniform_data {
     [[maybe_unused]] fluid_struct fluid;
     [[maybe_unused]] mesh_generation_struct mesh_generation;
     [[maybe_unused]] rendering_struct rendering;
-
+    [[maybe_unused]] temporal_struct temporal;
 };
 
 struct alignas(16) compute_uniform_data {
@@ -105,6 +168,9 @@ struct alignas(16) compute_uniform_data {
     [[maybe_unused]] uint32_t particle_cells_per_side;
     [[maybe_unused]] uint32_t side_voxel_count;
     [[maybe_unused]] uint32_t side_force_field_size;
+    [[maybe_unused]] uint32_t force_field_slot_count;
+    [[maybe_unused]] uint32_t force_field_slot_stride; // words
+    [[maybe_unused]] uint32_t force_field_format; // force_field_format::layout
 };
 
 struct alignas(16) compute_return_data {
@@ -117,6 +183,12 @@ struct alignas(16) compute_return_data {
     [[maybe_unused]] std::array<uint32_t,8> created_vertex_counts;
 };
 
+// push constants of the wavefront passes (see wavefront.glsl)
+struct wavefront_constants {
+    [[maybe_unused]] uint32_t bounce;
+    [[maybe_unused]] uint32_t sample_index;
+};
+
 struct instance_data {
     [[maybe_unused]] VkDeviceAddress vertex_buffer;
     [[maybe_unused]] VkDeviceAddress index_buffer;
@@ -131,6 +203,7 @@ public:
     uint32_t NUM_PARTICLE_BUFFER_SLICES = 3;
     uint32_t PARTICLE_MEM_SIZE = 44; //3*4*4+1;
     uint32_t SIDE_FORCE_FIELD_SIZE = 16*8+1;
+    uint32_t FORCE_FIELD_SLOTS = 6; // force field frames resident on the gpu, around the animation cursor
     uint32_t MAX_PRIMITIVES = 20'000'000;
     uint32_t MAX_INSTANCE_COUNT = 10;
     uint32_t SIDE_CUBE_GROUP_COUNT = 16;
@@ -138,14 +211,19 @@ public:
 
 
     const bool RT_AVAILIBLE;
+    const bool RAY_QUERY_AVAILIBLE;
 
     bool overlay_raster = false;
     bool disable_rt = false;
     bool render_point_cloud = false;
+    bool screen_space_fluid = false; // only while nothing is traced
+    int fluid_render_mode = FR::marching_cubes;
+    int tracer = TR::pipeline_tracer;
 
     uint32_t instance_count = 0;
 
     bool initialize_particles = true;
+    uint32_t live_particle_count{};
     bool init_with_lattice = false;
 
     uint32_t particle_read_slice_index = 0;
@@ -188,12 +266,32 @@ public:
     lava::pipeline_layout::ptr raster_pipeline_layout;
     lava::render_pipeline::ptr raster_pipeline;
 
+    // gpu driven raster: the static meshes share one arena and are drawn with one indirect multi draw,
+    // dynamic meshes (the fluid) keep their own buffers; both read their model matrix from raster_transform_buffer
+    struct raster_slice{
+        uint64_t scene_version{};
+        uint32_t static_draw_count{};
+        std::vector<uint32_t> static_transform_indices{}; // only used without drawIndirectFirstInstance
+        std::vector<std::pair<uint32_t, uint32_t>> dynamic_draws{}; // mesh index, transform index
+    };
+    uint32_t MAX_RASTER_DRAWS = 1024;
+    mesh_arena::ptr static_mesh_arena;
+    lava::buffer::ptr raster_command_buffer; // VkDrawIndexedIndirectCommand, one slice per frame in flight
+    lava::buffer::ptr raster_transform_buffer; // mat4, one slice per frame in flight
+    std::vector<raster_slice> raster_slices{};
+
     lava::pipeline_layout::ptr point_cloud_pipeline_layout;
     lava::render_pipeline::ptr point_cloud_pipeline;
+    // graphics queue only, point_cull.comp runs in the graphics submission
+    lava::buffer::ptr point_buffer; // visible particles (point_vertex), written by point_cull.comp
+    lava::buffer::ptr point_draw_buffer; // VkDrawIndirectCommand of the point cloud, written on the gpu
 
     lava::pipeline_layout::ptr rt_pipeline_layout;
     lava::rtt_extension::raytracing_pipeline::ptr rt_pipeline;
 
+    lava::pipeline_layout::ptr query_pipeline_layout;
+    lava::compute_pipeline::ptr query_pipeline;
+
     lava::pipeline_layout::ptr compute_pipeline_layout;
     lava::compute_pipeline::list compute_pipelines{};
 
@@ -204,8 +302,12 @@ public:
     std::unordered_map<std::string, uint32_t> mesh_index_lut;
 
     lava::rtt_extension::blas::list blas_list;
+    lava::rtt_extension::blas::ptr density_blas;
+    uint64_t density_instance_id{};
+    lava::rtt_extension::blas::ptr particle_blas;
+    uint64_t particle_instance_id{};
     lava::rtt_extension::tlas<instance_data>::ptr top_as;
-    lava::buffer::ptr scratch_buffer;
+    lava::rtt_extension::scratch_allocator::ptr as_scratch;
 
     uint32_t uniform_stride{};
     uniform_data uniforms{};
@@ -219,18 +321,65 @@ public:
     lava::buffer::ptr compute_shared_buffer;
     lava::buffer::ptr compute_tri_table_buffer;
     lava::buffer::ptr compute_debug_buffer;
+    lava::buffer::ptr density_block_buffer;
+    lava::buffer::ptr particle_aabb_buffer;
 
     uint32_t particle_head_grid_stride{};
     lava::buffer::ptr particle_head_grid;
     uint32_t particle_memory_stride{};
     lava::buffer::ptr particle_memory;
 
-    lava::buffer::ptr particle_force_field;
+    force_field_stream::ptr force_field;
 
     lava::image::ptr rt_image;
     VkSampler rt_sampler = VK_NULL_HANDLE;
 
-    lava::texture::ptr sky_box;
+    // temporal accumulation: rt_image (noisy trace) + guide_image -> resolved_image -> copied into history_image
+    // all of them have the trace resolution; with a render scale < 1 resolved_image is upscaled into upscaled_image
+    lava::image::ptr guide_image; // xyz: primary hit normal, w: primary hit distance
+    lava::image::ptr resolved_image;
+    lava::image::ptr history_image;
+    bool reset_history = true;
+
+    // adaptive sampling: pilot trace -> per pixel weights + global weight sum -> main trace
+    lava::image::ptr pilot_image;
+    lava::image::ptr weight_image;
+    lava::buffer::ptr sample_allocation_buffer;
+
+    // render scale presets offered in the ui (--render_scale accepts any value in [0.25, 1])
+    static constexpr std::array<float, 4> RENDER_SCALES = {1.0f, 0.75f, 0.67f, 0.5f};
+    lava::image::ptr upscaled_image;
+    float render_scale = 1.0f;
+    float applied_render_scale = 1.0f;
+
+    // screen space fluid: visible particles -> splatted depth + thickness -> smoothed depth -> resolved_image
+    lava::image::ptr ssf_depth_image; // float bits of the closest sphere depth (atomic min)
+    lava::image::ptr ssf_thickness_image; // fixed point sum of the sphere chords
+    lava::image::ptr ssf_smoothed_image;
+
+    // ray query tracer: persistent work groups pull 8x8 tiles from a counter until the image is done
+    uint32_t MAX_QUERY_WORK_GROUPS = 512;
+    lava::buffer::ptr query_tile_buffer;
+
+    // wavefront tracer: per traced pixel one path state (64 bytes) and two queues of path indices (one per bounce parity)
+    // the buffers only have the full size while the wavefront tracer is selected
+    uint32_t WAVEFRONT_RAY_SIZE = 64;
+    lava::buffer::ptr wavefront_ray_buffer;
+    lava::buffer::ptr wavefront_queue_buffer;
+    lava::buffer::ptr wavefront_command_buffer; // 2 VkTraceRaysIndirectCommandKHR (+ padding), written on the gpu
+    bool wavefront_allocated = false;
+
+    // gpu time of the trace (any tracer), two timestamps per frame in flight
+    VkQueryPool trace_timestamp_pool = VK_NULL_HANDLE;
+    std::vector<bool> trace_timestamps_written;
+    float trace_time_ms = 0.0f;
+
+    environment_map::ptr sky_box;
+
+    // SPIR-V of all shaders, precompiled at build time (see shader_cache.hpp)
+    shader_cache::ptr shaders;
+    // all pipelines are created against it, persisted next to the shader cache
+    pipeline_cache::ptr driver_pipeline_cache;
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     lava::engine &app;
@@ -241,9 +390,35 @@ public:
 
     std::shared_ptr<scene> active_scene;
 
+    // pipeline creation jobs (see setup_pipelines); the render pipelines are started in on_setup for the
+    // render pass of that time and picked up by on_swapchain_create
+    std::vector<std::future<bool>> pipeline_jobs;
+    std::vector<std::future<bool>> render_pipeline_jobs;
+    VkRenderPass render_pipelines_pass = VK_NULL_HANDLE;
+    // shader hot reload (see watch_shaders): the key of every shader a pipeline was created with, by name
+    bool shader_watch = true;
+    float shader_watch_timer = 0.0f;
+    std::mutex shader_keys_mutex;
+    std::unordered_map<std::string, uint64_t> shader_keys;
+    // the replacements of a running reload (see reload_pipelines), written by its jobs and swapped in by finish_reload
+    struct pipeline_reload {
+        std::vector<std::future<bool>> jobs;
+        VkRenderPass render_pass = VK_NULL_HANDLE;
+        lava::rtt_extension::raytracing_pipeline::ptr rt_pipeline;
+        lava::compute_pipeline::ptr query_pipeline;
+        lava::compute_pipeline::list compute_pipelines;
+        lava::render_pipeline::ptr blit_pipeline;
+        lava::render_pipeline::ptr raster_pipeline;
+        lava::render_pipeline::ptr point_cloud_pipeline;
+    };
+    std::unique_ptr<pipeline_reload> pending_reload;
+    // declared last, so it is destroyed (and finishes its jobs) before anything the jobs touch
+    thread_pool::ptr workers;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-    explicit inline core(lava::engine &app, bool RT, bool potato) : app(app), RT_AVAILIBLE(RT) {
-        render_point_cloud = !RT;
+    explicit inline core(lava::engine &app, bool RT, bool ray_query, bool potato)
+            : app(app), RT_AVAILIBLE(RT), RAY_QUERY_AVAILIBLE(RT && ray_query) {
+        screen_space_fluid = !RT;
 
         if(!potato)
             return;
@@ -272,6 +447,12 @@ public:
     inline lava::mesh_template<vert>::ptr get_named_mesh(const std::string &name){
         return meshes.at(mesh_index_lut.at(name));
     }
+    inline void set_render_scale(float scale){
+        render_scale = glm::clamp(scale, 0.25f, 1.0f);
+    }
+    [[nodiscard]] inline bool upscaling() const{
+        return applied_render_scale < 1.0f;
+    }
 
 private:
     bool setup_descriptors();
@@ -279,9 +460,33 @@ private:
     void setup_meshes(scene_importer &importer);
     void setup_scene(scene_importer &importer);
     void setup_descriptor_writes();
-    bool setup_pipelines();
+    bool setup_pipeline_layouts();
+    void setup_pipelines();
+    void setup_render_pipelines(VkRenderPass render_pass);
+    bool create_render_pipelines(VkRenderPass render_pass);
+    void add_render_pipelines(const lava::render_pass::ptr &render_pass);
+    lava::rtt_extension::raytracing_pipeline::ptr create_rt_pipeline();
+    lava::compute_pipeline::ptr create_query_pipeline();
+    lava::compute_pipeline::ptr create_compute_pipeline(CP index);
+    lava::render_pipeline::ptr create_blit_pipeline(VkRenderPass render_pass);
+    lava::render_pipeline::ptr create_raster_pipeline(VkRenderPass render_pass);
+    lava::render_pipeline::ptr create_point_cloud_pipeline(VkRenderPass render_pass);
+    void watch_shaders(float dt);
+    void reload_pipelines(const std::unordered_set<std::string> &changed);
+    void finish_reload();
+    lava::cdata get_shader(const std::string &name);
     void retrieve_compute_data(uint32_t frame);
     void simulation_step(uint32_t frame, VkCommandBuffer cmd_buf);
+    void allocate_samples(VkCommandBuffer cmd_buf);
+    void resolve_temporal(VkCommandBuffer cmd_buf);
+    void upscale(VkCommandBuffer cmd_buf);
+    void render_screen_space_fluid(VkCommandBuffer cmd_buf);
+    void update_raster_draws(uint32_t frame);
+    void trace_with_queries(VkCommandBuffer cmd_buf, uint32_t trace_width);
+    void trace_wavefront(VkCommandBuffer cmd_buf, uint32_t trace_width);
+    bool setup_wavefront_buffers(uint32_t ray_count);
+    void read_trace_time(uint32_t frame);
+    bool setup_render_targets();
 
     void limit_fps(float dt) const;
 };
@@ -0,0 +1,245 @@
+#include "environment_map.hpp"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+#include <stb_image.h>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace fb{
+
+using namespace lava;
+
+namespace {
+    constexpr std::array<char, 4> CACHE_MAGIC = {'F', 'B', 'E', 'M'};
+    constexpr uint32_t CACHE_VERSION = 1;
+    constexpr float MAX_HALF = 65504.0f;
+    // a full chain down to 1x1 of a 2^31 texel wide image, more levels can't be valid
+    constexpr uint32_t MAX_LEVEL_COUNT = 32;
+
+    struct cache_header{
+        std::array<char, 4> magic = CACHE_MAGIC;
+        uint32_t version = CACHE_VERSION;
+        uint64_t source_hash{};
+        uint32_t level_count{};
+        uint32_t padding{};
+    };
+
+    // FNV-1a, detects a changed source file
+    uint64_t hash_data(cdata data){
+        uint64_t hash = 14695981039346656037ull;
+        auto bytes = static_cast<const uint8_t*>(data.ptr);
+        for (size_t i = 0; i < data.size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // lat-long texels near the poles cover a smaller solid angle
+    float row_weight(uint32_t row, uint32_t height){
+        return std::sin(glm::pi<float>() * (float(row) + 0.5f) / float(height));
+    }
+}
+
+bool environment_map::build(cdata source) {
+    int width, height, channels;
+    float* pixels = stbi_loadf_from_memory(static_cast<const stbi_uc*>(source.ptr), int(source.size),
+                                           &width, &height, &channels, 3);
+    if (!pixels) {
+        log()->error("environment map: {}", stbi_failure_reason());
+        return false;
+    }
+
+    glm::uvec2 size{width, height};
+    std::vector<glm::vec3> level(size.x * size.y);
+    std::memcpy(level.data(), pixels, level.size() * sizeof(glm::vec3));
+    stbi_image_free(pixels);
+
+    level_sizes.clear();
+    texels.clear();
+    for (;;) {
+        level_sizes.push_back(size);
+        for (auto& texel : level)
+            texels.push_back(glm::packHalf(glm::vec4(glm::min(texel, glm::vec3(MAX_HALF)), 1.0f)));
+
+        if (size == glm::uvec2(1))
+            break;
+
+        const glm::uvec2 next_size = glm::max(size / 2u, glm::uvec2(1));
+        std::vector<glm::vec3> next_level(next_size.x * next_size.y);
+        for (uint32_t y = 0; y < next_size.y; y++) {
+            for (uint32_t x = 0; x < next_size.x; x++) {
+                glm::vec3 sum{};
+                float weight_sum = 0.0f;
+                for (uint32_t j = 0; j < 2; j++) {
+                    for (uint32_t i = 0; i < 2; i++) {
+                        const uint32_t sx = glm::min(x * 2 + i, size.x - 1);
+                        const uint32_t sy = glm::min(y * 2 + j, size.y - 1);
+                        const float weight = row_weight(sy, size.y);
+                        sum += level[sy * size.x + sx] * weight;
+                        weight_sum += weight;
+                    }
+                }
+                next_level[y * next_size.x + x] = weight_sum > 0.0f ? sum / weight_sum : glm::vec3(0);
+            }
+        }
+        level = std::move(next_level);
+        size = next_size;
+    }
+    return true;
+}
+
+bool environment_map::read_cache(const std::string& path, uint64_t source_hash) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    const auto file_size = uint64_t(file.tellg());
+    file.seekg(0);
+
+    cache_header header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+    if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.source_hash != source_hash ||
+        header.level_count == 0 || header.level_count > MAX_LEVEL_COUNT)
+        return false;
+
+    level_sizes.resize(header.level_count);
+    if (!file.read(reinterpret_cast<char*>(level_sizes.data()), std::streamsize(level_sizes.size() * sizeof(glm::uvec2))))
+        return false;
+
+    // the levels have to be the chain build() makes, and the texels exactly the rest of the file
+    uint64_t texel_count = 0;
+    for (size_t level = 0; level < level_sizes.size(); level++) {
+        const glm::uvec2 size = level_sizes[level];
+        const bool last = level + 1 == level_sizes.size();
+        if (size.x == 0 || size.y == 0 || (level > 0 && size != glm::max(level_sizes[level - 1] / 2u, glm::uvec2(1))) ||
+            last != (size == glm::uvec2(1))) {
+            log()->warn("environment map: cache {} has a broken mip chain", path);
+            return false;
+        }
+        texel_count += uint64_t(size.x) * size.y;
+    }
+    if (file_size != sizeof(header) + level_sizes.size() * sizeof(glm::uvec2) + texel_count * sizeof(glm::u16vec4)) {
+        log()->warn("environment map: cache {} has the wrong size", path);
+        return false;
+    }
+    texels.resize(texel_count);
+    if (!file.read(reinterpret_cast<char*>(texels.data()), std::streamsize(texels.size() * sizeof(glm::u16vec4))))
+        return false;
+
+    log()->debug("environment map: loaded mip chain from {}", path);
+    return true;
+}
+
+void environment_map::write_cache(const std::string& path, uint64_t source_hash) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        log()->warn("environment map: can't write cache {}", path);
+        return;
+    }
+
+    const cache_header header{.source_hash = source_hash, .level_count = uint32_t(level_sizes.size())};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(level_sizes.data()), std::streamsize(level_sizes.size() * sizeof(glm::uvec2)));
+    file.write(reinterpret_cast<const char*>(texels.data()), std::streamsize(texels.size() * sizeof(glm::u16vec4)));
+}
+
+bool environment_map::load(device_p dev, const std::string& source_path, cdata source) {
+    device = dev;
+    if (!source.ptr) {
+        log()->error("environment map: {} not found", source_path);
+        return false;
+    }
+
+    const uint64_t source_hash = hash_data(source);
+    const std::string cache_path = source_path + ".mips";
+    if (!read_cache(cache_path, source_hash)) {
+        log()->info("environment map: building mip chain for {}", source_path);
+        if (!build(source))
+            return false;
+        write_cache(cache_path, source_hash);
+    }
+
+    image = image::make(VK_FORMAT_R16G16B16A16_SFLOAT);
+    image->set_usage(VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    image->set_level_count(get_level_count());
+    if (!image->create(device, level_sizes.front()))
+        return false;
+
+    staging_buffer = buffer::make();
+    if (!staging_buffer->create(device, texels.data(), texels.size() * sizeof(glm::u16vec4), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                false, VMA_MEMORY_USAGE_CPU_ONLY))
+        return false;
+    texels.clear();
+    texels.shrink_to_fit();
+
+    const VkSamplerCreateInfo sampler_info{
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .mipLodBias = 0.f,
+        .anisotropyEnable = VK_FALSE,
+        .compareEnable = VK_FALSE,
+        .compareOp = VK_COMPARE_OP_NEVER,
+        .minLod = 0.f,
+        .maxLod = float(get_level_count()),
+        .borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+        .unnormalizedCoordinates = VK_FALSE,
+    };
+    if (!device->vkCreateSampler(&sampler_info, &sampler)) {
+        log()->error("environment map: create sampler");
+        return false;
+    }
+
+    descriptor_info = {.sampler = sampler,
+                       .imageView = image->get_view(),
+                       .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    return true;
+}
+
+void environment_map::stage(VkCommandBuffer cmd_buf, bool ray_tracing) {
+    insert_image_memory_barrier(device, cmd_buf, image->get(),
+                                0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                image->get_subresource_range());
+
+    std::vector<VkBufferImageCopy> regions;
+    VkDeviceSize offset = 0;
+    for (uint32_t level = 0; level < get_level_count(); level++) {
+        const glm::uvec2 size = level_sizes[level];
+        regions.push_back(VkBufferImageCopy{.bufferOffset = offset,
+                                            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+                                            .imageExtent = {size.x, size.y, 1}});
+        offset += VkDeviceSize(size.x) * size.y * sizeof(glm::u16vec4);
+    }
+    vkCmdCopyBufferToImage(cmd_buf, staging_buffer->get(), image->get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           uint32_t(regions.size()), regions.data());
+
+    insert_image_memory_barrier(device, cmd_buf, image->get(),
+                                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                    (ray_tracing ? VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR : VkPipelineStageFlags(0)),
+                                image->get_subresource_range());
+}
+
+void environment_map::destroy() {
+    if (sampler) {
+        device->vkDestroySampler(sampler);
+        sampler = VK_NULL_HANDLE;
+    }
+    if (image)
+        image->destroy();
+    if (staging_buffer)
+        staging_buffer->destroy();
+}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <string>
+#include <vector>
+
+namespace fb{
+
+// HDR lat-long sky box with a prefiltered mip chain (solid angle weighted 2x2 box filter per level).
+// The chain is cached next to the source file (<source>.mips) and only rebuilt if the source changes.
+class environment_map{
+    lava::device_p device{};
+
+    std::vector<glm::uvec2> level_sizes{};
+    std::vector<glm::u16vec4> texels{}; // rgba16f, all levels after each other
+
+    lava::image::ptr image;
+    lava::buffer::ptr staging_buffer;
+    VkSampler sampler = VK_NULL_HANDLE;
+    VkDescriptorImageInfo descriptor_info{};
+
+    bool build(lava::cdata source);
+    bool read_cache(const std::string& path, uint64_t source_hash);
+    void write_cache(const std::string& path, uint64_t source_hash) const;
+
+public:
+    using ptr = std::shared_ptr<environment_map>;
+
+    bool load(lava::device_p device, const std::string& source_path, lava::cdata source);
+
+    // uploads the mip chain; the image is in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL afterwards, for the compute
+    // and, with ray_tracing (only valid if the device has it enabled), the ray tracing shaders
+    void stage(VkCommandBuffer cmd_buf, bool ray_tracing);
+
+    void destroy();
+
+    [[nodiscard]] inline const VkDescriptorImageInfo* get_descriptor_info() const{
+        return &descriptor_info;
+    }
+
+    [[nodiscard]] inline uint32_t get_level_count() const{
+        return uint32_t(level_sizes.size());
+    }
+
+    inline static ptr make(){
+        return std::make_shared<environment_map>();
+    }
+};
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Brick compressed force field file (written by fb_force_field_baker, read by force_field_stream and decoded in
+// sim_particles.comp). The legacy format is raw: frames of side^3 vec4 (force xyz, dampening w), x outermost.
+//
+// file:  file_header, frame_entry[frame_count], frames (16 byte aligned)
+// frame: one word per brick (bricks_per_side^3, x outermost): data_offset << 2 | brick_type, the offset in words
+//        from the start of the frame, followed by the brick data
+// brick: BRICK_SIZE^3 points (x outermost); points past the edge of the grid are never read
+namespace fb::force_field_format{
+
+constexpr std::array<char, 4> MAGIC = {'F', 'B', 'F', 'F'};
+constexpr uint32_t VERSION = 2;
+constexpr uint32_t BRICK_SIZE = 8;
+constexpr uint32_t BRICK_POINTS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+constexpr uint32_t MAX_PALETTE_SIZE = 16;
+constexpr uint32_t MAX_QUANTIZED_BITS = 16;
+constexpr uint32_t QUANTIZED_GRADIENT_BIT = 1u << 20;
+
+// keep in sync with sim_particles.comp
+enum brick_type : uint32_t{
+    constant = 0, // one vec4
+    palette = 1,  // BRICK_POINTS 4 bit indices (8 per word, lowest bits first), then up to 16 vec4
+    half = 2,     // BRICK_POINTS points as 2 words of packed halfs (xy, zw), for values quantized can't hold
+    // a descriptor word (bit count of each component in 5 bits, x lowest, 0 for components constant over the brick;
+    // QUANTIZED_GRADIENT_BIT), the minimum and step vec4, with the gradient bit a vec3 gradient per component, then
+    // the points as a stream of unsigned integers, components in order, lowest bits first:
+    // value = minimum + integer * step + dot(gradient, position in the brick)
+    quantized = 3,
+};
+
+// how the shader reads the frames in the ring (compute_uniform_data::force_field_format)
+enum layout : uint32_t{
+    raw = 0,
+    bricks = 1,
+};
+
+struct file_header{
+    std::array<char, 4> magic = MAGIC;
+    uint32_t version = VERSION;
+    uint32_t side_size{};
+    uint32_t brick_size = BRICK_SIZE;
+    uint32_t frame_count{};
+    uint32_t max_frame_size{}; // bytes
+};
+
+// bytes, from the start of the file
+struct frame_entry{
+    uint64_t offset{};
+    uint64_t size{};
+};
+
+constexpr uint32_t get_bricks_per_side(uint32_t side_size){
+    return (side_size + BRICK_SIZE - 1) / BRICK_SIZE;
+}
+
+}
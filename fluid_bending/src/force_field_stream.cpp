@@ -0,0 +1,344 @@
+#include "force_field_stream.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace fb{
+
+using namespace lava;
+
+namespace{
+    namespace ff = force_field_format;
+
+    // The shader reads the bricks without bounds checks, so the data every brick header points to has to be inside
+    // its frame (word_count words, headers first): a palette up to its largest index, a quantized brick as many bits
+    // as its descriptor says.
+    bool validate_bricks(const uint32_t* words, uint64_t word_count, uint32_t brick_count){
+        for (uint32_t brick = 0; brick < brick_count; brick++) {
+            const uint64_t offset = words[brick] >> 2;
+            if (offset < brick_count || offset >= word_count)
+                return false;
+            const uint32_t* data = words + offset;
+            const uint64_t available = word_count - offset;
+
+            uint64_t size = 0;
+            switch (words[brick] & 3u) {
+            case ff::constant:
+                size = 4;
+                break;
+            case ff::palette: {
+                constexpr uint32_t index_words = ff::BRICK_POINTS / 8;
+                if (available < index_words)
+                    return false;
+                uint32_t max_index = 0;
+                for (uint32_t i = 0; i < index_words; i++) {
+                    for (uint32_t j = 0; j < 8; j++)
+                        max_index = std::max(max_index, data[i] >> (j * 4) & 15u);
+                }
+                size = index_words + (max_index + 1) * 4;
+                break;
+            }
+            case ff::half:
+                size = ff::BRICK_POINTS * 2;
+                break;
+            case ff::quantized: {
+                const uint32_t descriptor = data[0];
+                if ((descriptor & ~(ff::QUANTIZED_GRADIENT_BIT | (ff::QUANTIZED_GRADIENT_BIT - 1))) != 0)
+                    return false;
+                uint32_t point_bits = 0;
+                for (uint32_t c = 0; c < 4; c++) {
+                    const uint32_t bits = descriptor >> (c * 5) & 31u;
+                    if (bits > ff::MAX_QUANTIZED_BITS)
+                        return false;
+                    point_bits += bits;
+                }
+                size = 9 + ((descriptor & ff::QUANTIZED_GRADIENT_BIT) != 0 ? 12 : 0) + uint64_t(ff::BRICK_POINTS) * point_bits / 32;
+                break;
+            }
+            }
+            if (size > available)
+                return false;
+        }
+        return true;
+    }
+}
+
+bool force_field_stream::create(device_p dev, thread_pool::ptr pool, const std::string& path, uint32_t side_size,
+                                uint32_t slots){
+    device = dev;
+    workers = std::move(pool);
+
+    if (!file.open(path)) {
+        log()->error("force field: can't map {}", path);
+        return false;
+    }
+    if (!read_frame_table(side_size))
+        return false;
+    frame_count = uint32_t(frames.size());
+    slot_count = std::min(std::max(slots, 2u), frame_count);
+    slot_frames.assign(slot_count, NO_FRAME);
+
+    // the transfer queue writes the ring, the compute (and graphics) queue reads it
+    const bool has_transfer_queue = !device->get_transfer_queues().empty();
+    upload_queue = has_transfer_queue ? device->get_transfer_queue(0) : device->get_graphics_queue(0);
+    std::vector<uint32_t> queue_families = {device->get_graphics_queue(0).family};
+    for (uint32_t family : {device->get_compute_queue(0).family, upload_queue.family}) {
+        if (std::find(queue_families.begin(), queue_families.end(), family) == queue_families.end())
+            queue_families.push_back(family);
+    }
+    const VkSharingMode sharing_mode = queue_families.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+
+    ring = buffer::make();
+    if (!ring->create(device, nullptr, slot_size * slot_count,
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false,
+                      VMA_MEMORY_USAGE_GPU_ONLY, sharing_mode, queue_families)) {
+        log()->error("create force field ring");
+        return false;
+    }
+
+    const VkCommandPoolCreateInfo pool_info{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = upload_queue.family,
+    };
+    if (!check(vkCreateCommandPool(device->get(), &pool_info, memory::instance().alloc(), &command_pool))) {
+        log()->error("create force field command pool");
+        return false;
+    }
+
+    for (auto& upload : uploads) {
+        upload.staging = buffer::make();
+        if (!upload.staging->create_mapped(device, nullptr, slot_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                           VMA_MEMORY_USAGE_CPU_ONLY)) {
+            log()->error("create force field staging buffer");
+            return false;
+        }
+
+        const VkCommandBufferAllocateInfo alloc_info{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = command_pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1,
+        };
+        const VkFenceCreateInfo fence_info{
+                .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        };
+        if (!check(vkAllocateCommandBuffers(device->get(), &alloc_info, &upload.cmd_buf)) ||
+            !check(vkCreateFence(device->get(), &fence_info, memory::instance().alloc(), &upload.fence))) {
+            log()->error("create force field upload");
+            return false;
+        }
+    }
+
+    // the simulation needs the first frames right away, so they are copied here instead of waiting for the workers
+    // behind the pipeline jobs
+    start_uploads(0, true);
+    for (auto& upload : uploads) {
+        if (upload.state == upload_state::uploading)
+            vkWaitForFences(device->get(), 1, &upload.fence, VK_TRUE, UINT64_MAX);
+    }
+    retire_uploads();
+    if (!is_resident(0)) {
+        log()->error("upload force field");
+        return false;
+    }
+
+    log()->debug("force field: {} {} frames mapped from {}, {} resident ({} MB, {} queue)", frame_count,
+                 format == force_field_format::bricks ? "brick compressed" : "raw", path, slot_count,
+                 (slot_size * slot_count) >> 20, has_transfer_queue ? "transfer" : "graphics");
+    return true;
+}
+
+void force_field_stream::destroy(){
+    for (auto& upload : uploads) {
+        if (upload.state == upload_state::copying)
+            upload.copied.wait();
+        if (upload.state == upload_state::uploading)
+            vkWaitForFences(device->get(), 1, &upload.fence, VK_TRUE, UINT64_MAX);
+        upload.state = upload_state::idle;
+
+        if (upload.fence != VK_NULL_HANDLE)
+            vkDestroyFence(device->get(), upload.fence, memory::instance().alloc());
+        upload.fence = VK_NULL_HANDLE;
+        upload.cmd_buf = VK_NULL_HANDLE;
+        if (upload.staging)
+            upload.staging->destroy();
+    }
+    if (command_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device->get(), command_pool, memory::instance().alloc());
+        command_pool = VK_NULL_HANDLE;
+    }
+    if (ring)
+        ring->destroy();
+    slot_frames.clear();
+    file.close();
+}
+
+bool force_field_stream::read_frame_table(uint32_t side_size){
+    const auto contents = file.get();
+    ff::file_header header;
+    if (contents.size() < sizeof(header) || std::memcmp(contents.data(), ff::MAGIC.data(), ff::MAGIC.size()) != 0) {
+        // legacy: the file is nothing but frames
+        format = ff::raw;
+        slot_size = VkDeviceSize(side_size) * side_size * side_size * 4 * sizeof(float);
+        if (contents.size() % slot_size != 0) {
+            log()->error("force field size incompatibility");
+            return false;
+        }
+        frames.resize(contents.size() / slot_size);
+        for (size_t i = 0; i < frames.size(); i++)
+            frames[i] = {.offset = i * slot_size, .size = slot_size};
+        return true;
+    }
+
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if (header.version != ff::VERSION || header.side_size != side_size || header.brick_size != ff::BRICK_SIZE ||
+        header.frame_count == 0 || contents.size() < sizeof(header) + uint64_t(header.frame_count) * sizeof(ff::frame_entry)) {
+        log()->error("force field: unsupported brick file (version {}, side {})", header.version, header.side_size);
+        return false;
+    }
+    format = ff::bricks;
+    frames.resize(header.frame_count);
+    std::memcpy(frames.data(), contents.data() + sizeof(header), frames.size() * sizeof(ff::frame_entry));
+
+    const uint32_t bricks_per_side = ff::get_bricks_per_side(side_size);
+    const uint32_t brick_count = bricks_per_side * bricks_per_side * bricks_per_side;
+    const uint64_t min_frame_size = uint64_t(brick_count) * sizeof(uint32_t);
+    for (size_t i = 0; i < frames.size(); i++) {
+        const auto& frame = frames[i];
+        if (frame.offset % sizeof(uint32_t) != 0 || frame.size < min_frame_size || frame.size > header.max_frame_size ||
+            frame.offset > contents.size() || frame.size > contents.size() - frame.offset) {
+            log()->error("force field: broken frame table");
+            return false;
+        }
+        // the mapping is page aligned and the offset a multiple of 4
+        const auto* words = reinterpret_cast<const uint32_t*>(contents.data() + frame.offset);
+        if (!validate_bricks(words, frame.size / sizeof(uint32_t), brick_count)) {
+            log()->error("force field: broken bricks in frame {}", i);
+            return false;
+        }
+    }
+    slot_size = align_up(VkDeviceSize(header.max_frame_size), VkDeviceSize(16));
+    return true;
+}
+
+float force_field_stream::update(float animation_index){
+    retire_uploads();
+    if (is_playable(animation_index))
+        playable_index = animation_index;
+    start_uploads(std::min(uint32_t(std::max(animation_index, 0.f)), frame_count - 1));
+    return playable_index;
+}
+
+uint32_t force_field_stream::get_resident_count() const{
+    return uint32_t(std::count_if(slot_frames.begin(), slot_frames.end(), [](uint32_t frame) { return frame != NO_FRAME; }));
+}
+
+bool force_field_stream::is_resident(uint32_t frame) const{
+    return slot_frames[frame % slot_count] == frame;
+}
+
+// the shader reads int(index) and, between two frames, the one after it
+bool force_field_stream::is_playable(float animation_index) const{
+    const float frame = std::floor(std::max(animation_index, 0.f));
+    if (frame >= float(frame_count))
+        return false;
+    const auto first = uint32_t(frame);
+    if (!is_resident(first))
+        return false;
+    return animation_index == frame || first + 1 >= frame_count || is_resident(first + 1);
+}
+
+void force_field_stream::retire_uploads(){
+    for (auto& upload : uploads) {
+        // No semaphore hands the ring from the upload queue to the simulation: a slot is only marked resident once the
+        // host saw the fence of its copy (which makes the writes available), and only submissions made after that read
+        // it. The fence wait is the visibility guarantee, so the simulation never waits on the upload queue.
+        if (upload.state == upload_state::uploading && vkGetFenceStatus(device->get(), upload.fence) == VK_SUCCESS) {
+            slot_frames[upload.frame % slot_count] = upload.frame;
+            upload.state = upload_state::idle;
+        }
+        if (upload.state == upload_state::copying &&
+            upload.copied.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            upload.copied.get();
+            if (!submit_upload(upload)) {
+                log()->error("force field: upload of frame {} failed", upload.frame);
+                upload.state = upload_state::idle;
+            }
+        }
+    }
+}
+
+void force_field_stream::start_uploads(uint32_t first_frame, bool copy_inline){
+    // the frames of the playable index can still be read by the submission this update is for
+    const auto protected_frame = uint32_t(playable_index);
+    auto is_protected = [&](uint32_t frame) {
+        return frame != NO_FRAME && (frame == protected_frame || (frame == protected_frame + 1 && playable_index != float(protected_frame)));
+    };
+
+    const uint32_t end_frame = std::min(first_frame + slot_count, frame_count);
+    for (uint32_t frame = first_frame; frame < end_frame; frame++) {
+        const uint32_t slot = frame % slot_count;
+        if (slot_frames[slot] == frame || is_protected(slot_frames[slot]))
+            continue;
+        if (std::any_of(uploads.begin(), uploads.end(), [&](const upload_job& upload) {
+                return upload.state != upload_state::idle && upload.frame % slot_count == slot;
+            }))
+            continue;
+
+        auto idle = std::find_if(uploads.begin(), uploads.end(), [](const upload_job& upload) { return upload.state == upload_state::idle; });
+        if (idle == uploads.end())
+            return;
+
+        slot_frames[slot] = NO_FRAME;
+        idle->frame = frame;
+        void* staging = idle->staging->get_mapped_data();
+        const uint8_t* source = file.get().data() + frames[frame].offset;
+        const size_t size = frames[frame].size;
+        if (copy_inline) {
+            std::memcpy(staging, source, size);
+            if (!submit_upload(*idle)) {
+                log()->error("force field: upload of frame {} failed", frame);
+                idle->state = upload_state::idle;
+            }
+            continue;
+        }
+        // reading the mapping faults the pages in, which is the slow part, so it happens on a worker
+        idle->state = upload_state::copying;
+        idle->copied = workers->submit([staging, source, size] { std::memcpy(staging, source, size); });
+    }
+}
+
+bool force_field_stream::submit_upload(upload_job& upload){
+    if (!check(vkResetFences(device->get(), 1, &upload.fence)) || !check(vkResetCommandBuffer(upload.cmd_buf, 0)))
+        return false;
+
+    const VkCommandBufferBeginInfo begin_info{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    if (!check(vkBeginCommandBuffer(upload.cmd_buf, &begin_info)))
+        return false;
+    const VkBufferCopy region{
+            .srcOffset = 0,
+            .dstOffset = (upload.frame % slot_count) * slot_size,
+            .size = frames[upload.frame].size,
+    };
+    vkCmdCopyBuffer(upload.cmd_buf, upload.staging->get(), ring->get(), 1, &region);
+    if (!check(vkEndCommandBuffer(upload.cmd_buf)))
+        return false;
+
+    const VkSubmitInfo submit_info{
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &upload.cmd_buf,
+    };
+    if (!check(vkQueueSubmit(upload_queue.vk_queue, 1, &submit_info, upload.fence)))
+        return false;
+    upload.state = upload_state::uploading;
+    return true;
+}
+
+}
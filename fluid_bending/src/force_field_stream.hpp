@@ -0,0 +1,113 @@
+#pragma once
+
+#include "force_field_format.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+#include <liblava/lava.hpp>
+#include <array>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace fb{
+
+// Plays the force field animation out of a memory mapped file (res/force_fields/field.bin, raw or brick compressed,
+// see force_field_format.hpp) with only a window of frames resident on the gpu: frame f lives in slot f % slot_count
+// of a device local ring buffer. Brick compressed frames stay compressed in the ring, the simulation decodes them.
+// The frames ahead of the playback are copied from the mapping into staging buffers on the workers and uploaded
+// on the transfer queue while the simulation runs, so the start up time doesn't depend on the animation length.
+// The simulation reads a frame only after the host saw the fence of its upload, there is no semaphore between the queues.
+class force_field_stream{
+public:
+    static constexpr uint32_t NO_FRAME = ~0u;
+    // uploads that can be in flight at once (one staging buffer each)
+    static constexpr uint32_t UPLOAD_COUNT = 2;
+
+private:
+    enum class upload_state{
+        idle,
+        copying,   // the worker fills the staging buffer
+        uploading, // the copy into the ring is submitted, fence pending
+    };
+
+    struct upload_job{
+        upload_state state = upload_state::idle;
+        uint32_t frame = NO_FRAME;
+        lava::buffer::ptr staging;
+        std::future<void> copied;
+        VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+    };
+
+    lava::device_p device = nullptr;
+    thread_pool::ptr workers;
+    mapped_file file;
+    lava::queue upload_queue{};
+    VkCommandPool command_pool = VK_NULL_HANDLE;
+
+    force_field_format::layout format = force_field_format::raw;
+    std::vector<force_field_format::frame_entry> frames; // where each frame is in the file
+    VkDeviceSize slot_size = 0;
+    uint32_t frame_count = 0;
+    uint32_t slot_count = 0;
+    lava::buffer::ptr ring;
+    std::vector<uint32_t> slot_frames; // frame resident in each slot (NO_FRAME while empty or being overwritten)
+    std::array<upload_job, UPLOAD_COUNT> uploads;
+
+    // index handed to the simulation last; its frames stay resident until a newer index is playable
+    float playable_index = 0.f;
+
+public:
+    using ptr = std::shared_ptr<force_field_stream>;
+
+    // maps the file (frames of side_size^3 points) and uploads the first frames before returning
+    bool create(lava::device_p device, thread_pool::ptr workers, const std::string& path, uint32_t side_size,
+                uint32_t slot_count);
+
+    // waits for the uploads in flight
+    void destroy();
+
+    // Call once per simulation submission while no earlier submission reads the ring: retires finished uploads,
+    // starts the uploads of the frames from animation_index on and returns the index the simulation should use,
+    // animation_index if its frames are resident, otherwise the last playable index.
+    float update(float animation_index);
+
+    [[nodiscard]] inline const lava::buffer::ptr& get_buffer() const{
+        return ring;
+    }
+
+    [[nodiscard]] inline uint32_t get_frame_count() const{
+        return frame_count;
+    }
+
+    [[nodiscard]] inline uint32_t get_slot_count() const{
+        return slot_count;
+    }
+
+    [[nodiscard]] inline force_field_format::layout get_format() const{
+        return format;
+    }
+
+    // distance between two slots of the ring in words
+    [[nodiscard]] inline uint32_t get_slot_stride() const{
+        return uint32_t(slot_size / sizeof(uint32_t));
+    }
+
+    // frames of the window that are resident right now
+    [[nodiscard]] uint32_t get_resident_count() const;
+
+    inline static ptr make(){
+        return std::make_shared<force_field_stream>();
+    }
+
+private:
+    bool read_frame_table(uint32_t side_size);
+    [[nodiscard]] bool is_resident(uint32_t frame) const;
+    [[nodiscard]] bool is_playable(float animation_index) const;
+    void retire_uploads();
+    void start_uploads(uint32_t first_frame, bool copy_inline = false);
+    bool submit_upload(upload_job& upload);
+};
+
+}
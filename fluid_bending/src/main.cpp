@@ -1,12 +1,14 @@
 #include "core.hpp"
 
+#include <chrono>
+
 using namespace lava;
 using namespace fb;
 
-bool check_rt_support(device::create_param &param){
+bool check_extension_support(device::create_param &param, const char* extension_name){
     auto adaptor_features = param.physical_device->get_extension_properties();
     for (auto& feature : adaptor_features) {
-        if(strcmp(feature.extensionName,VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME) == 0)
+        if(strcmp(feature.extensionName,extension_name) == 0)
             return true;
     }
     return false;
@@ -42,6 +44,8 @@ void configure_non_rt_params(device::create_param &param){
 }
 
 int run(int argc, char* argv[]) {
+    const auto start_time = std::chrono::steady_clock::now();
+
     frame_env env;
     env.info.app_name = "Fluid Bending";
     env.cmd_line = {argc, argv};
@@ -50,18 +54,24 @@ int run(int argc, char* argv[]) {
     bool rt = !env.cmd_line.flags().contains("no_rt");
     bool async_execution = !env.cmd_line.flags().contains("sync");
     bool potato = env.cmd_line.flags().contains("potato");
+    bool ray_query = true;
 
     engine app(env);
 
     rtt_extension::rt_helper::param_creator pc{};
     app.platform.on_create_param = [&](device::create_param &param) {
-        rt = rt && check_rt_support(param);
+        rt = rt && check_extension_support(param, VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME);
+        ray_query = rt && ray_query && check_extension_support(param, VK_KHR_RAY_QUERY_EXTENSION_NAME);
 
         if (rt) {
-            pc.configure_params_for_ray_tracing(param);
+            pc.configure_params_for_ray_tracing(param, ray_query);
         } else {
             configure_non_rt_params(param);
         }
+        // optional, used by the indirect raster of the scene (core::update_raster_draws)
+        const auto &supported_features = param.physical_device->get_features();
+        param.features.multiDrawIndirect = supported_features.multiDrawIndirect;
+        param.features.drawIndirectFirstInstance = supported_features.drawIndirectFirstInstance;
         param.add_dedicated_queues();
     };
 
@@ -78,7 +88,7 @@ int run(int argc, char* argv[]) {
     }
 
 
-    core core{app, rt, potato};
+    core core{app, rt, ray_query, potato};
 
     core.on_pre_setup();
 
@@ -230,6 +240,9 @@ int run(int argc, char* argv[]) {
                                        async_compute_fences[0]))
             return false;
 
+        if (first_frame_on_process)
+            log()->info("time to first frame: {:.1f} ms",
+                        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count());
         first_frame_on_process = false;
         return true;
     };
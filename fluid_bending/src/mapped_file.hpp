@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace fb{
+
+// Read only memory mapping of a whole file; the pages are only read from disk when they are touched.
+class mapped_file{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+
+public:
+    using ptr = std::shared_ptr<mapped_file>;
+
+    mapped_file() = default;
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // false if the file doesn't exist, is empty or can't be mapped
+    bool open(const std::string& path);
+
+    void close();
+
+    [[nodiscard]] inline std::span<const uint8_t> get() const{
+        return {data, size};
+    }
+
+    [[nodiscard]] inline bool is_open() const{
+        return data != nullptr;
+    }
+
+    inline static ptr make(){
+        return std::make_shared<mapped_file>();
+    }
+};
+}
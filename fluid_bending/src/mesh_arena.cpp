@@ -0,0 +1,144 @@
+#include "mesh_arena.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace fb{
+
+using namespace lava;
+
+namespace {
+    // the shaders access the arena through buffer references, which assume 16 byte alignment by default;
+    // every mesh starts at a multiple of these counts
+    constexpr uint32_t VERTEX_ALIGNMENT = std::lcm(uint32_t(sizeof(vert)), 16u) / uint32_t(sizeof(vert));
+    constexpr uint32_t INDEX_ALIGNMENT = 16 / sizeof(ui32);
+
+    constexpr VkBufferUsageFlags ARENA_USAGE = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                                               VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+                                               VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+}
+
+bool mesh_arena::create(device_p device, std::span<const source> meshes){
+    ranges.clear();
+    if (meshes.empty())
+        return true;
+
+    uint32_t vertex_count = 0;
+    uint32_t index_count = 0;
+    for (auto &mesh : meshes){
+        vertex_count = align_up(vertex_count, VERTEX_ALIGNMENT);
+        index_count = align_up(index_count, INDEX_ALIGNMENT);
+        ranges.push_back(range{
+            .first_index = index_count,
+            .index_count = mesh.index_count,
+            .vertex_offset = int32_t(vertex_count),
+            .vertex_count = mesh.vertex_count});
+        vertex_count += mesh.vertex_count;
+        index_count += mesh.index_count;
+    }
+    const VkDeviceSize vertex_size = VkDeviceSize(vertex_count) * sizeof(vert);
+    const VkDeviceSize index_size = VkDeviceSize(index_count) * sizeof(ui32);
+    if (vertex_size == 0 || index_size == 0){
+        // nothing to draw or trace, and vulkan buffers can't be empty
+        log()->debug("mesh arena: {} meshes without triangles, arena left empty", meshes.size());
+        ranges.clear();
+        return true;
+    }
+
+    // the transfer queue writes, the graphics and compute queues read
+    const bool has_transfer_queue = !device->get_transfer_queues().empty();
+    const queue &upload_queue = has_transfer_queue ? device->get_transfer_queue(0) : device->get_graphics_queue(0);
+    std::vector<uint32_t> queue_families = {device->get_graphics_queue(0).family};
+    for (uint32_t family : {device->get_compute_queue(0).family, upload_queue.family}){
+        if (std::find(queue_families.begin(), queue_families.end(), family) == queue_families.end())
+            queue_families.push_back(family);
+    }
+    const VkSharingMode sharing_mode = queue_families.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+
+    vertex_buffer = buffer::make();
+    if (!vertex_buffer->create(device, nullptr, vertex_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | ARENA_USAGE, false,
+                               VMA_MEMORY_USAGE_GPU_ONLY, sharing_mode, queue_families)){
+        log()->error("create mesh arena vertex buffer");
+        ranges.clear();
+        return false;
+    }
+
+    index_buffer = buffer::make();
+    if (!index_buffer->create(device, nullptr, index_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | ARENA_USAGE, false,
+                              VMA_MEMORY_USAGE_GPU_ONLY, sharing_mode, queue_families)){
+        log()->error("create mesh arena index buffer");
+        ranges.clear();
+        return false;
+    }
+
+    // vertices first, then the indices; the padding between the meshes is copied as well (one region per buffer)
+    auto staging_buffer = buffer::make();
+    if (!staging_buffer->create_mapped(device, nullptr, vertex_size + index_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                       VMA_MEMORY_USAGE_CPU_ONLY)){
+        log()->error("create mesh arena staging buffer");
+        ranges.clear();
+        return false;
+    }
+    auto *staging = static_cast<uint8_t *>(staging_buffer->get_mapped_data());
+    for (size_t i = 0; i < meshes.size(); ++i){
+        std::memcpy(staging + VkDeviceSize(ranges[i].vertex_offset) * sizeof(vert), meshes[i].vertices,
+                    size_t(meshes[i].vertex_count) * sizeof(vert));
+        std::memcpy(staging + vertex_size + VkDeviceSize(ranges[i].first_index) * sizeof(ui32), meshes[i].indices,
+                    size_t(meshes[i].index_count) * sizeof(ui32));
+    }
+
+    const bool uploaded = one_time_submit(device, upload_queue, [&](VkCommandBuffer cmd_buf){
+        const VkBufferCopy vertex_region{.srcOffset = 0, .dstOffset = 0, .size = vertex_size};
+        vkCmdCopyBuffer(cmd_buf, staging_buffer->get(), vertex_buffer->get(), 1, &vertex_region);
+        const VkBufferCopy index_region{.srcOffset = vertex_size, .dstOffset = 0, .size = index_size};
+        vkCmdCopyBuffer(cmd_buf, staging_buffer->get(), index_buffer->get(), 1, &index_region);
+    });
+    staging_buffer->destroy();
+    if (!uploaded){
+        log()->error("upload mesh arena");
+        ranges.clear();
+        return false;
+    }
+
+    log()->debug("mesh arena: {} meshes, {} vertices, {} indices ({} queue)", meshes.size(), vertex_count, index_count,
+                 has_transfer_queue ? "transfer" : "graphics");
+    return true;
+}
+
+void mesh_arena::destroy(){
+    if (vertex_buffer)
+        vertex_buffer->destroy();
+    if (index_buffer)
+        index_buffer->destroy();
+    ranges.clear();
+}
+
+void mesh_arena::bind(VkCommandBuffer cmd_buf) const{
+    const VkBuffer buffers[] = {vertex_buffer->get()};
+    const VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(cmd_buf, 0, 1, buffers, offsets);
+    vkCmdBindIndexBuffer(cmd_buf, index_buffer->get(), 0, VK_INDEX_TYPE_UINT32);
+}
+
+VkDeviceAddress mesh_arena::get_vertex_address(uint32_t mesh_index) const{
+    return vertex_buffer->get_address() + VkDeviceAddress(get_range(mesh_index).vertex_offset) * sizeof(vert);
+}
+
+VkDeviceAddress mesh_arena::get_index_address(uint32_t mesh_index) const{
+    return index_buffer->get_address() + VkDeviceAddress(get_range(mesh_index).first_index) * sizeof(ui32);
+}
+
+VkAccelerationStructureGeometryTrianglesDataKHR mesh_arena::get_triangles(uint32_t mesh_index) const{
+    return {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+        .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+        .vertexData = {get_vertex_address(mesh_index)},
+        .vertexStride = sizeof(vert),
+        .maxVertex = get_range(mesh_index).vertex_count,
+        .indexType = VK_INDEX_TYPE_UINT32,
+        .indexData = {get_index_address(mesh_index)},
+    };
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "types_and_data.hpp"
+
+#include <liblava/lava.hpp>
+#include <span>
+#include <vector>
+
+namespace fb{
+
+// The vertices and indices of many meshes in one device local vertex and one index buffer, so all of them can be
+// drawn with a single bind and one indirect multi draw, and the ray tracer and the blas builds read them from there.
+// The meshes are uploaded through one staging buffer in a single submission on the transfer queue.
+class mesh_arena{
+public:
+    // the part of the arena that belongs to one mesh (fields of VkDrawIndexedIndirectCommand, plus the vertex count)
+    struct range{
+        uint32_t first_index{};
+        uint32_t index_count{};
+        int32_t vertex_offset{};
+        uint32_t vertex_count{};
+    };
+
+    // the data of one mesh to upload; only read during create
+    struct source{
+        const vert* vertices{};
+        uint32_t vertex_count{};
+        const lava::ui32* indices{};
+        uint32_t index_count{};
+    };
+
+private:
+    lava::buffer::ptr vertex_buffer;
+    lava::buffer::ptr index_buffer;
+    std::vector<range> ranges{};
+
+public:
+    using ptr = std::shared_ptr<mesh_arena>;
+
+    // uploads the meshes into the arena, the range of meshes[i] is get_range(i);
+    // without any vertices or indices the arena stays empty
+    bool create(lava::device_p device, std::span<const source> meshes);
+
+    void destroy();
+
+    // binds the arena as vertex buffer 0 and index buffer
+    void bind(VkCommandBuffer cmd_buf) const;
+
+    [[nodiscard]] inline const range& get_range(uint32_t mesh_index) const{
+        return ranges.at(mesh_index);
+    }
+
+    // start of the mesh in the arena buffers, for buffer references (instance_data) in the shaders
+    [[nodiscard]] VkDeviceAddress get_vertex_address(uint32_t mesh_index) const;
+    [[nodiscard]] VkDeviceAddress get_index_address(uint32_t mesh_index) const;
+
+    // geometry of the mesh for a blas
+    [[nodiscard]] VkAccelerationStructureGeometryTrianglesDataKHR get_triangles(uint32_t mesh_index) const;
+
+    [[nodiscard]] inline bool empty() const{
+        return ranges.empty();
+    }
+
+    inline static ptr make(){
+        return std::make_shared<mesh_arena>();
+    }
+};
+}
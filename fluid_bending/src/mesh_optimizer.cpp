@@ -0,0 +1,199 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+namespace fb::mesh_optimizer{
+
+namespace {
+    constexpr uint32_t NO_INDEX = std::numeric_limits<uint32_t>::max();
+
+    // hashes the bits of the components, with -0 folded onto 0 so it agrees with vert::operator==
+    struct vert_hash{
+        size_t operator()(const vert& v) const{
+            const std::array<float, 6> components{v.position.x, v.position.y, v.position.z, v.normal.x, v.normal.y, v.normal.z};
+            uint64_t hash = 14695981039346656037ull;
+            for (float component : components) {
+                component += 0.f;
+                uint32_t bits;
+                std::memcpy(&bits, &component, sizeof(bits));
+                hash = (hash ^ bits) * 1099511628211ull;
+            }
+            return size_t(hash);
+        }
+    };
+
+    // Forsyth's scoring, with his constants
+    constexpr float CACHE_DECAY_POWER = 1.5f;
+    constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+    constexpr float VALENCE_BOOST_SCALE = 2.f;
+    constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+    float vertex_score(int32_t cache_position, uint32_t remaining_triangles){
+        if (remaining_triangles == 0)
+            return -1.f;
+        float score = 0.f;
+        if (cache_position >= 0) {
+            if (cache_position < 3)
+                score = LAST_TRIANGLE_SCORE;
+            else
+                score = std::pow(1.f - float(cache_position - 3) / float(CACHE_SIZE - 3), CACHE_DECAY_POWER);
+        }
+        return score + VALENCE_BOOST_SCALE * std::pow(float(remaining_triangles), -VALENCE_BOOST_POWER);
+    }
+}
+
+uint32_t weld_vertices(std::vector<vert>& vertices, std::vector<uint32_t>& indices) {
+    std::unordered_map<vert, uint32_t, vert_hash> unique;
+    unique.reserve(vertices.size());
+    std::vector<uint32_t> remap(vertices.size());
+    std::vector<vert> welded;
+    welded.reserve(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        auto [it, inserted] = unique.try_emplace(vertices[i], uint32_t(welded.size()));
+        if (inserted)
+            welded.push_back(vertices[i]);
+        remap[i] = it->second;
+    }
+    for (auto& index : indices)
+        index = remap[index];
+
+    const auto removed = uint32_t(vertices.size() - welded.size());
+    vertices = std::move(welded);
+    return removed;
+}
+
+void optimize_vertex_cache(std::vector<uint32_t>& indices, uint32_t vertex_count) {
+    const auto triangle_count = uint32_t(indices.size() / 3);
+    if (triangle_count == 0)
+        return;
+
+    // triangles of each vertex that aren't emitted yet: adjacency[offsets[v], offsets[v] + remaining[v])
+    std::vector<uint32_t> remaining(vertex_count, 0);
+    for (uint32_t i = 0; i < triangle_count * 3; i++)
+        remaining[indices[i]]++;
+    std::vector<uint32_t> offsets(vertex_count + 1, 0);
+    for (uint32_t v = 0; v < vertex_count; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<uint32_t> adjacency(offsets[vertex_count]);
+    {
+        std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+        for (uint32_t i = 0; i < triangle_count * 3; i++)
+            adjacency[filled[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int32_t> cache_position(vertex_count, -1);
+    std::vector<float> scores(vertex_count);
+    for (uint32_t v = 0; v < vertex_count; v++)
+        scores[v] = vertex_score(-1, remaining[v]);
+    std::vector<float> triangle_scores(triangle_count);
+    for (uint32_t t = 0; t < triangle_count; t++)
+        triangle_scores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+    std::vector<bool> emitted(triangle_count, false);
+
+    // one slot of slack for each vertex of the triangle pushed in front, the overflow is evicted
+    std::array<uint32_t, CACHE_SIZE + 3> cache{};
+    std::array<uint32_t, CACHE_SIZE + 3> next_cache{};
+    uint32_t cache_count = 0;
+
+    std::vector<uint32_t> optimized;
+    optimized.reserve(indices.size());
+
+    uint32_t best = 0;
+    uint32_t scan = 0;
+    while (best != NO_INDEX) {
+        emitted[best] = true;
+        const uint32_t* triangle = &indices[best * 3];
+        optimized.insert(optimized.end(), triangle, triangle + 3);
+
+        // the triangle's vertices move to the front, the rest keep their order behind them
+        uint32_t next_count = 0;
+        for (uint32_t c = 0; c < 3; c++) {
+            const uint32_t v = triangle[c];
+            if (c == 0 || (v != triangle[0] && (c == 1 || v != triangle[1])))
+                next_cache[next_count++] = v;
+
+            auto begin = adjacency.begin() + offsets[v];
+            auto end = begin + remaining[v];
+            std::iter_swap(std::find(begin, end, best), end - 1);
+            remaining[v]--;
+        }
+        for (uint32_t i = 0; i < cache_count; i++) {
+            const uint32_t v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                next_cache[next_count++] = v;
+        }
+        for (uint32_t i = CACHE_SIZE; i < next_count; i++)
+            cache_position[next_cache[i]] = -1;
+        cache_count = std::min(next_count, CACHE_SIZE);
+        std::swap(cache, next_cache);
+
+        // rescore everything that moved (the evicted vertices included) and the triangles around it
+        for (uint32_t i = 0; i < next_count; i++) {
+            const uint32_t v = cache[i];
+            if (i < CACHE_SIZE)
+                cache_position[v] = int32_t(i);
+            const float score = vertex_score(cache_position[v], remaining[v]);
+            const float delta = score - scores[v];
+            scores[v] = score;
+            for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+                triangle_scores[adjacency[a]] += delta;
+        }
+
+        // the next triangle comes from the cache if any cached vertex has triangles left
+        best = NO_INDEX;
+        float best_score = -std::numeric_limits<float>::max();
+        for (uint32_t i = 0; i < cache_count; i++) {
+            const uint32_t v = cache[i];
+            for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; a++) {
+                const uint32_t t = adjacency[a];
+                if (triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best = t;
+                }
+            }
+        }
+        // otherwise start over at the first triangle left, which keeps the fallback linear overall
+        if (best == NO_INDEX) {
+            while (scan < triangle_count && emitted[scan])
+                scan++;
+            if (scan < triangle_count)
+                best = scan;
+        }
+    }
+
+    indices = std::move(optimized);
+}
+
+void optimize_vertex_fetch(std::vector<vert>& vertices, std::vector<uint32_t>& indices) {
+    std::vector<uint32_t> remap(vertices.size(), NO_INDEX);
+    std::vector<vert> reordered;
+    reordered.reserve(vertices.size());
+    for (auto& index : indices) {
+        if (remap[index] == NO_INDEX) {
+            remap[index] = uint32_t(reordered.size());
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices = std::move(reordered);
+}
+
+float average_cache_miss_ratio(const std::vector<uint32_t>& indices, uint32_t vertex_count, uint32_t cache_size) {
+    if (indices.size() < 3)
+        return 0.f;
+    // FIFO: a vertex is cached if it was transformed less than cache_size misses ago
+    std::vector<uint32_t> transformed_at(vertex_count, NO_INDEX);
+    uint32_t misses = 0;
+    for (auto index : indices) {
+        if (transformed_at[index] == NO_INDEX || misses - transformed_at[index] >= cache_size)
+            transformed_at[index] = misses++;
+    }
+    return float(misses) / float(indices.size() / 3);
+}
+
+}
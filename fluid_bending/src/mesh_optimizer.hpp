@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types_and_data.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Import time optimisation of triangle lists (see scene_importer::convert), independent of the gpu:
+// weld_vertices, then optimize_vertex_cache, then optimize_vertex_fetch.
+namespace fb::mesh_optimizer{
+
+// post transform cache size the orderings are optimised for (and average_cache_miss_ratio simulates)
+constexpr uint32_t CACHE_SIZE = 32;
+
+// merges identical vertices (vert::operator==, -0 equals 0) and rewrites the indices; returns the number removed
+uint32_t weld_vertices(std::vector<vert>& vertices, std::vector<uint32_t>& indices);
+
+// reorders the triangles for the post transform vertex cache (Forsyth, "Linear-Speed Vertex Cache Optimisation");
+// neighbouring triangles are also close in the index buffer afterwards, which gives the blas builder better input
+void optimize_vertex_cache(std::vector<uint32_t>& indices, uint32_t vertex_count);
+
+// orders the vertices by their first use in the index buffer (and drops unused ones), so fetches are sequential
+void optimize_vertex_fetch(std::vector<vert>& vertices, std::vector<uint32_t>& indices);
+
+// transformed vertices per triangle with a FIFO cache of cache_size entries (0.5 is the optimum, 3 the worst)
+float average_cache_miss_ratio(const std::vector<uint32_t>& indices, uint32_t vertex_count, uint32_t cache_size = CACHE_SIZE);
+
+}
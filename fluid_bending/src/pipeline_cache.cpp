@@ -0,0 +1,89 @@
+#include "pipeline_cache.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace fb{
+
+using namespace lava;
+
+namespace {
+    bool matches_device(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties){
+        VkPipelineCacheHeaderVersionOne header{};
+        if (data.size() < sizeof(header))
+            return false;
+        std::memcpy(&header, data.data(), sizeof(header));
+        return header.headerSize >= sizeof(header) &&
+               header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+               header.vendorID == properties.vendorID &&
+               header.deviceID == properties.deviceID &&
+               std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+}
+
+bool pipeline_cache::create(device_p dev, const std::string& directory) {
+    device = dev;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device->get_vk_physical_device(), &properties);
+    path = (std::filesystem::path(directory) /
+            ("pipelines_" + std::to_string(properties.vendorID) + "_" + std::to_string(properties.deviceID) + ".bin")).string();
+
+    std::vector<char> data;
+    if (std::ifstream file{path, std::ios::binary | std::ios::ate}) {
+        data.resize(size_t(file.tellg()));
+        file.seekg(0);
+        if (!file.read(data.data(), std::streamsize(data.size())))
+            data.clear();
+    }
+    if (!data.empty() && !matches_device(data, properties)) {
+        log()->info("pipeline cache: {} belongs to another device or driver, starting empty", path);
+        data.clear();
+    }
+    loaded_size = data.size();
+
+    const VkPipelineCacheCreateInfo create_info{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data.size(),
+        .pInitialData = data.empty() ? nullptr : data.data(),
+    };
+    if (!check(vkCreatePipelineCache(device->get(), &create_info, memory::instance().alloc(), &cache))) {
+        log()->error("pipeline cache: create");
+        return false;
+    }
+    return true;
+}
+
+bool pipeline_cache::save() const {
+    if (cache == VK_NULL_HANDLE)
+        return false;
+
+    size_t size = 0;
+    if (!check(vkGetPipelineCacheData(device->get(), cache, &size, nullptr)))
+        return false;
+    std::vector<char> data(size);
+    if (!check(vkGetPipelineCacheData(device->get(), cache, &size, data.data())))
+        return false;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file || !file.write(data.data(), std::streamsize(size))) {
+        log()->warn("pipeline cache: can't write {}", path);
+        return false;
+    }
+    log()->debug("pipeline cache: saved {} bytes to {}", size, path);
+    return true;
+}
+
+void pipeline_cache::destroy() {
+    if (cache != VK_NULL_HANDLE) {
+        vkDestroyPipelineCache(device->get(), cache, memory::instance().alloc());
+        cache = VK_NULL_HANDLE;
+    }
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <liblava/lava.hpp>
+#include <string>
+
+namespace fb{
+
+// VkPipelineCache that is kept on disk between runs (and Ctrl+Enter reloads) as
+// <directory>/pipelines_<vendor id>_<device id>.bin. A file is only handed to the driver if its header
+// matches the device (vendor, device and pipelineCacheUUID), so after a driver update the cache starts empty.
+class pipeline_cache{
+    lava::device_p device{};
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    std::string path{};
+    size_t loaded_size = 0;
+
+public:
+    using ptr = std::shared_ptr<pipeline_cache>;
+
+    bool create(lava::device_p device, const std::string& directory);
+
+    // writes the current content of the cache to the file
+    bool save() const;
+
+    void destroy();
+
+    [[nodiscard]] inline VkPipelineCache get() const{
+        return cache;
+    }
+
+    // size of the cache data taken from the file (0 if there was no valid file)
+    [[nodiscard]] inline size_t get_loaded_size() const{
+        return loaded_size;
+    }
+
+    inline static ptr make(){
+        return std::make_shared<pipeline_cache>();
+    }
+};
+}
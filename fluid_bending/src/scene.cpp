@@ -35,6 +35,7 @@ uint32_t scene::add_node(uint32_t parent, std::string_view name, const glm::mat4
 
     auto id = node.id;
     nodes.insert({node.id,std::move(node)});
+    version++;
     return id;
 }
 
@@ -58,6 +59,7 @@ void scene::remove_node(uint32_t id) {
 
         nodes.erase(id);
     }
+    version++;
 }
 
 void scene::adopt(uint32_t parent, uint32_t id) {
@@ -100,14 +102,16 @@ void scene::prepare_for_rendering() {
 
     std::vector<scene_node*> node_stack{&root};
 
+    bool changed = false;
     while(!node_stack.empty()){
         auto &node = *node_stack.back();
         node_stack.pop_back();
         for(auto& child_id: node.children){
             scene_node& child = nodes.at(child_id);
-            if(node.update_required){
+            if(node.update_required || child.update_required){
                 child.update_required = true;
                 child.accumulated_transform = node.accumulated_transform * child.transform;
+                changed = true;
 
                 if(child.type == mesh){
                     instance_target.set_instance_transform(child.payload.mesh.instance_id, child.accumulated_transform);
@@ -119,8 +123,15 @@ void scene::prepare_for_rendering() {
             }
             if(!child.children.empty()){
                 node_stack.emplace_back(&child);
+            }else{
+                child.update_required = false;
             }
         }
+        // all children have their accumulated transform now
+        node.update_required = false;
+    }
+    if(changed){
+        version++;
     }
 
 }
@@ -66,11 +66,17 @@ public:
 
     void prepare_for_rendering();
 
+    // changes whenever a node is added, removed or moved (after prepare_for_rendering)
+    [[nodiscard]] inline uint64_t get_version() const{
+        return version;
+    }
+
 
     std::unordered_map<uint32_t, scene_node> nodes{};
 
 private:
     uint32_t next_id{1};
+    uint64_t version{1};
     core& instance_target;
 };
 
@@ -1,9 +1,16 @@
 #include "scene_importer.hpp"
 #include "liblava/lava.hpp"
+#include "mesh_optimizer.hpp"
 
 
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
 
 template<typename T>
 bool create(lava::mesh_template<T> &mesh, lava::device_p d,
@@ -38,42 +45,125 @@ bool create(lava::mesh_template<T> &mesh, lava::device_p d,
 
 namespace fb {
 
-void scene_importer::read_mesh(const std::string &name, aiMesh *mesh, lava::mesh_template<vert>::list &meshes) {
-    std::vector<vert> vertices{};
-    std::vector<uint32_t> indices{};
-    for (size_t i = 0; i < mesh->mNumVertices; ++i) {
-        vert v = {
-                glm::vec3{mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z},
-                glm::vec3{mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z},
-//                glm::vec3{mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z},
-//                glm::vec2{mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y},
+namespace {
+    constexpr std::array<char, 4> CACHE_MAGIC = {'F', 'B', 'S', 'C'};
+    // bump if the conversion changes (2: meshes are welded and reordered by mesh_optimizer)
+    constexpr uint32_t CACHE_VERSION = 2;
+    constexpr uint32_t NO_INDEX = ~0u;
+
+    constexpr unsigned IMPORT_FLAGS = aiProcess_CalcTangentSpace |
+                                      aiProcess_Triangulate |
+                                      aiProcess_FindInvalidData |
+                                      aiProcess_SortByPType |
+                                      aiProcess_GenSmoothNormals |
+                                      aiProcess_ForceGenNormals;
+
+    // layout of the binary form: header, meshes, nodes, names, vertices, indices (each section 16 byte aligned)
+    struct cache_header{
+        std::array<char, 4> magic = CACHE_MAGIC;
+        uint32_t version = CACHE_VERSION;
+        uint64_t source_hash{};
+        uint32_t vertex_size = sizeof(vert);
+        uint32_t mesh_count{};
+        uint32_t node_count{};
+        uint32_t padding{};
+        uint64_t meshes_offset{};
+        uint64_t nodes_offset{};
+        uint64_t names_offset{};
+        uint64_t names_size{};
+        uint64_t vertices_offset{};
+        uint64_t vertex_count{};
+        uint64_t indices_offset{};
+        uint64_t index_count{};
+    };
+
+    struct cache_mesh{
+        uint32_t name_offset{};
+        uint32_t name_size{};
+        uint32_t vertex_count{};
+        uint32_t index_count{};
+        uint64_t first_vertex{};
+        uint64_t first_index{};
+    };
+
+    // in depth first order, so a parent always comes before its children
+    struct cache_node{
+        glm::mat4 transform{};
+        uint32_t parent = NO_INDEX; // NO_INDEX: child of the scene root
+        uint32_t mesh_index = NO_INDEX;
+        uint32_t name_offset{};
+        uint32_t name_size{};
+    };
+
+    // FNV-1a over the source file and the import flags
+    uint64_t hash_source(lava::cdata data){
+        uint64_t hash = 14695981039346656037ull;
+        auto hash_bytes = [&](const void* ptr, size_t size) {
+            auto bytes = static_cast<const uint8_t*>(ptr);
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
         };
-        vertices.push_back(v);
+        hash_bytes(&IMPORT_FLAGS, sizeof(IMPORT_FLAGS));
+        hash_bytes(data.ptr, data.size);
+        return hash;
     }
 
-    for (size_t i = 0; i < mesh->mNumFaces; ++i) {
-        aiFace *face = &mesh->mFaces[i];
-        assert(face->mNumIndices == 3);
-        for (size_t j = 0; j < face->mNumIndices; ++j) {
-            indices.emplace_back(face->mIndices[j]);
-        }
+    uint64_t align_section(uint64_t offset){
+        return (offset + 15) & ~uint64_t(15);
     }
 
-    lava::log()->debug("Loading Mesh:{}  VertexCount:{}  IndexCount:{}  FaceCount:{} ",
-                       mesh->mName.C_Str(), mesh->mNumVertices, mesh->mNumFaces*3,mesh->mNumFaces);
-
-    auto data = create_mesh_data<vert>(lava::mesh_type::triangle);
-    data.indices = indices;
-    data.vertices = vertices;
-
-    auto m = std::make_shared<lava::mesh_template<vert>>();
+    template<typename T>
+    void append(std::vector<uint8_t>& out, uint64_t offset, const T* items, size_t count){
+        out.resize(std::max<size_t>(out.size(), offset + count * sizeof(T)));
+        if (count > 0)
+            std::memcpy(out.data() + offset, items, count * sizeof(T));
+    }
 
-    m->add_data(data);
-    m->create(device);
-    create(*m,device);
+    // the records are read in place (the sections are aligned), checking that they are within the data
+    template<typename T>
+    const T* section(std::span<const uint8_t> data, uint64_t offset, uint64_t count){
+        if (offset > data.size() || count > (data.size() - offset) / sizeof(T) || offset % alignof(T) != 0)
+            return nullptr;
+        return reinterpret_cast<const T*>(data.data() + offset);
+    }
 
-    meshes.push_back(m);
-    mesh_ids.insert({name, uint32_t(meshes.size()) - 1});
+    // the records only reference data within their sections: meshes their vertices, indices and names, indices
+    // vertices of their own mesh, nodes earlier parents, existing meshes and names
+    bool validate_records(std::span<const uint8_t> data, const cache_header& header){
+        const auto *meshes = section<cache_mesh>(data, header.meshes_offset, header.mesh_count);
+        const auto *nodes = section<cache_node>(data, header.nodes_offset, header.node_count);
+        const auto *indices = section<uint32_t>(data, header.indices_offset, header.index_count);
+        if (!meshes || !nodes || !indices || !section<char>(data, header.names_offset, header.names_size) ||
+            !section<vert>(data, header.vertices_offset, header.vertex_count))
+            return false;
+
+        for (uint32_t i = 0; i < header.mesh_count; ++i) {
+            const cache_mesh &mesh = meshes[i];
+            if (mesh.first_vertex > header.vertex_count || mesh.vertex_count > header.vertex_count - mesh.first_vertex ||
+                mesh.first_index > header.index_count || mesh.index_count > header.index_count - mesh.first_index ||
+                uint64_t(mesh.name_offset) + mesh.name_size > header.names_size) {
+                lava::log()->warn("scene cache: mesh {} is out of bounds", i);
+                return false;
+            }
+            const auto *first = indices + mesh.first_index;
+            if (std::any_of(first, first + mesh.index_count, [&](uint32_t index) { return index >= mesh.vertex_count; })) {
+                lava::log()->warn("scene cache: mesh {} has indices past its {} vertices", i, mesh.vertex_count);
+                return false;
+            }
+        }
+        for (uint32_t i = 0; i < header.node_count; ++i) {
+            const cache_node &node = nodes[i];
+            if ((node.parent != NO_INDEX && node.parent >= i) ||
+                (node.mesh_index != NO_INDEX && node.mesh_index >= header.mesh_count) ||
+                uint64_t(node.name_offset) + node.name_size > header.names_size) {
+                lava::log()->warn("scene cache: node {} is invalid", i);
+                return false;
+            }
+        }
+        return true;
+    }
 }
 
 static glm::mat4 aiMatrix4x4ToGlm(const aiMatrix4x4 *from) {
@@ -98,81 +188,249 @@ static glm::mat4 aiMatrix4x4ToGlm(const aiMatrix4x4 *from) {
 }
 
 
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "misc-no-recursion"
+// flattens ai_scene into the binary form; the node walk matches the one scene::add_node expects (depth first)
+void scene_importer::convert(const aiScene *ai_scene, uint64_t source_hash) {
+    std::vector<cache_mesh> meshes;
+    std::vector<cache_node> nodes;
+    std::string names;
+    std::vector<vert> vertices;
+    std::vector<uint32_t> indices;
+
+    auto add_name = [&](const char* name, uint32_t& offset, uint32_t& size) {
+        offset = uint32_t(names.size());
+        size = uint32_t(std::strlen(name));
+        names += name;
+    };
+
+    std::unordered_map<std::string, uint32_t> mesh_ids;
+    std::vector<vert> mesh_vertices;
+    std::vector<uint32_t> mesh_indices;
+    for (uint32_t m = 0; m < ai_scene->mNumMeshes; ++m) {
+        const aiMesh *mesh = ai_scene->mMeshes[m];
+
+        mesh_vertices.clear();
+        for (size_t i = 0; i < mesh->mNumVertices; ++i) {
+            mesh_vertices.push_back(vert{
+                    glm::vec3{mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z},
+                    glm::vec3{mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z},
+            });
+        }
 
-void scene_importer::walk_tree(const aiScene *aiS, aiNode *aiNode, scene &scene, uint32_t head) {
-    for (size_t i = 0; i < aiNode->mNumChildren; ++i) {
-        auto *child = aiNode->mChildren[i];
-        glm::mat4 transform = aiMatrix4x4ToGlm(&child->mTransformation);
+        mesh_indices.clear();
+        for (size_t i = 0; i < mesh->mNumFaces; ++i) {
+            const aiFace *face = &mesh->mFaces[i];
+            assert(face->mNumIndices == 3);
+            mesh_indices.insert(mesh_indices.end(), face->mIndices, face->mIndices + face->mNumIndices);
+        }
 
-        node_payload payload{};
-        node_type type = node_type::base;
+        // assimp keeps the file's order and splits vertices per face; this only runs on a cache miss
+        const float acmr_before = mesh_optimizer::average_cache_miss_ratio(mesh_indices, uint32_t(mesh_vertices.size()));
+        const uint32_t welded = mesh_optimizer::weld_vertices(mesh_vertices, mesh_indices);
+        mesh_optimizer::optimize_vertex_cache(mesh_indices, uint32_t(mesh_vertices.size()));
+        mesh_optimizer::optimize_vertex_fetch(mesh_vertices, mesh_indices);
+        lava::log()->debug("scene import: mesh {} welded {} of {} vertices, ACMR {:.3f} -> {:.3f}",
+                           mesh->mName.C_Str(), welded, mesh->mNumVertices, acmr_before,
+                           mesh_optimizer::average_cache_miss_ratio(mesh_indices, uint32_t(mesh_vertices.size())));
+
+        cache_mesh record{
+                .vertex_count = uint32_t(mesh_vertices.size()),
+                .index_count = uint32_t(mesh_indices.size()),
+                .first_vertex = vertices.size(),
+                .first_index = indices.size(),
+        };
+        add_name(mesh->mName.C_Str(), record.name_offset, record.name_size);
+        vertices.insert(vertices.end(), mesh_vertices.begin(), mesh_vertices.end());
+        indices.insert(indices.end(), mesh_indices.begin(), mesh_indices.end());
 
-        if (child->mNumMeshes > 0) {
-            auto temp = aiS->mMeshes[child->mMeshes[0]];
-            aiString mat_name;
-            aiS->mMaterials[temp->mMaterialIndex]->Get(AI_MATKEY_NAME, mat_name);
-            auto mesh_index = mesh_ids.at(temp->mName.C_Str());
+        meshes.push_back(record);
+        // nodes refer to meshes by name, the first mesh of a name wins
+        mesh_ids.insert({mesh->mName.C_Str(), m});
+    }
 
-            type = node_type::mesh;
-            payload.mesh = {
-                    .mesh_index = mesh_index
-            };
+    // (node, parent record) pairs; children are pushed in reverse so they are visited in order
+    std::vector<std::pair<const aiNode*, uint32_t>> stack;
+    for (uint32_t i = ai_scene->mRootNode->mNumChildren; i-- > 0;)
+        stack.emplace_back(ai_scene->mRootNode->mChildren[i], NO_INDEX);
+    while (!stack.empty()) {
+        auto [node, parent] = stack.back();
+        stack.pop_back();
+
+        cache_node record{
+                .transform = aiMatrix4x4ToGlm(&node->mTransformation),
+                .parent = parent,
+        };
+        if (node->mNumMeshes > 0)
+            record.mesh_index = mesh_ids.at(ai_scene->mMeshes[node->mMeshes[0]]->mName.C_Str());
+        add_name(node->mName.C_Str(), record.name_offset, record.name_size);
+
+        const auto index = uint32_t(nodes.size());
+        nodes.push_back(record);
+        for (uint32_t i = node->mNumChildren; i-- > 0;)
+            stack.emplace_back(node->mChildren[i], index);
+    }
 
-        }
-        auto node_name = child->mName.C_Str();
-        auto new_id = scene.add_node(head, node_name, transform, type, payload);
-        walk_tree(aiS, child, scene, new_id);
+    cache_header header{
+            .source_hash = source_hash,
+            .mesh_count = uint32_t(meshes.size()),
+            .node_count = uint32_t(nodes.size()),
+            .names_size = names.size(),
+            .vertex_count = vertices.size(),
+            .index_count = indices.size(),
+    };
+    header.meshes_offset = align_section(sizeof(cache_header));
+    header.nodes_offset = align_section(header.meshes_offset + meshes.size() * sizeof(cache_mesh));
+    header.names_offset = align_section(header.nodes_offset + nodes.size() * sizeof(cache_node));
+    header.vertices_offset = align_section(header.names_offset + names.size());
+    header.indices_offset = align_section(header.vertices_offset + vertices.size() * sizeof(vert));
+
+    converted.clear();
+    append(converted, 0, &header, 1);
+    append(converted, header.meshes_offset, meshes.data(), meshes.size());
+    append(converted, header.nodes_offset, nodes.data(), nodes.size());
+    append(converted, header.names_offset, names.data(), names.size());
+    append(converted, header.vertices_offset, vertices.data(), vertices.size());
+    append(converted, header.indices_offset, indices.data(), indices.size());
+    contents = converted;
+}
+
+bool scene_importer::read_cache(const std::string &path, uint64_t source_hash) {
+    if (!cache_file.open(path))
+        return false;
+
+    const auto mapped = cache_file.get();
+    const auto *header = section<cache_header>(mapped, 0, 1);
+    const bool valid = header && header->magic == CACHE_MAGIC && header->version == CACHE_VERSION &&
+                       header->source_hash == source_hash && header->vertex_size == sizeof(vert) &&
+                       validate_records(mapped, *header);
+    if (!valid) {
+        // stale or broken, the scene is imported again and the cache rewritten
+        cache_file.close();
+        return false;
     }
+    contents = mapped;
+    return true;
 }
 
-#pragma clang diagnostic pop
+void scene_importer::write_cache(const std::string &path) const {
+    // write and rename, so an interrupted write never leaves a cache that looks valid
+    const std::string temp = path + ".tmp";
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write(reinterpret_cast<const char*>(contents.data()), std::streamsize(contents.size()))) {
+            lava::log()->warn("scene cache: can't write {}", path);
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    if (ec)
+        lava::log()->warn("scene cache: can't write {}", path);
+}
 
 scene_importer::scene_importer(const std::string &path, lava::device_p device) : device(device) {
     if(path.length() == 0)
         return;
-    ai_scene = importer.ReadFile(path,
-                                 aiProcess_CalcTangentSpace |
-                                 aiProcess_Triangulate |
-                                 aiProcess_FindInvalidData |
-                                 aiProcess_SortByPType |
-                                 aiProcess_GenSmoothNormals |
-                                 aiProcess_ForceGenNormals);
+    Assimp::Importer importer{};
+    if (auto *ai_scene = importer.ReadFile(path, IMPORT_FLAGS))
+        convert(ai_scene, 0);
 }
 
-scene_importer::scene_importer(lava::cdata data, lava::device_p device) : device(device) {
-    if(data.size == 0)
+scene_importer::scene_importer(lava::cdata source, lava::device_p device, const std::string &cache_path) : device(device) {
+    if(source.size == 0)
+        return;
+
+    const uint64_t source_hash = hash_source(source);
+    if (!cache_path.empty() && read_cache(cache_path, source_hash)) {
+        lava::log()->debug("scene cache: mapped {}", cache_path);
         return;
-    ai_scene = importer.ReadFileFromMemory(data.ptr, data.size,
-                                 aiProcess_CalcTangentSpace |
-                                 aiProcess_Triangulate |
-                                 aiProcess_FindInvalidData |
-                                 aiProcess_SortByPType |
-                                 aiProcess_GenSmoothNormals |
-                                 aiProcess_ForceGenNormals);
+    }
+
+    Assimp::Importer importer{};
+    auto *ai_scene = importer.ReadFileFromMemory(source.ptr, source.size, IMPORT_FLAGS);
+    if (ai_scene == nullptr) {
+        lava::log()->error("scene import: {}", importer.GetErrorString());
+        return;
+    }
+    convert(ai_scene, source_hash);
+    if (!cache_path.empty())
+        write_cache(cache_path);
 }
 
-std::pair<lava::mesh_template<vert>::list,std::vector<std::string>> scene_importer::load_meshes() {
-    if(ai_scene == nullptr)
+std::pair<lava::mesh_template<vert>::list,std::vector<std::string>> scene_importer::load_meshes(mesh_arena &arena) {
+    if(contents.empty())
         return {{},{}};
 
+    const auto *header = section<cache_header>(contents, 0, 1);
+    const auto *records = section<cache_mesh>(contents, header->meshes_offset, header->mesh_count);
+    const auto *names = section<char>(contents, header->names_offset, header->names_size);
+    const auto *vertices = section<vert>(contents, header->vertices_offset, header->vertex_count);
+    const auto *indices = section<uint32_t>(contents, header->indices_offset, header->index_count);
+
     lava::mesh_template<vert>::list meshes{};
-    std::vector<std::string> names{};
+    std::vector<std::string> mesh_names{};
+    std::vector<mesh_arena::source> sources{};
+
+    for (uint32_t i = 0; i < header->mesh_count; ++i) {
+        const cache_mesh &record = records[i];
+        std::string name(names + record.name_offset, record.name_size);
+
+        lava::log()->debug("Loading Mesh:{}  VertexCount:{}  IndexCount:{}  FaceCount:{} ",
+                           name, record.vertex_count, record.index_count, record.index_count / 3);
+
+        // the arena is staged straight from the binary form (mapped or converted)
+        sources.push_back(mesh_arena::source{
+                .vertices = vertices + record.first_vertex,
+                .vertex_count = record.vertex_count,
+                .indices = indices + record.first_index,
+                .index_count = record.index_count,
+        });
+
+        // the meshes keep a copy of their data but no buffers of their own, they are drawn and traced from the arena
+        auto mesh_data = create_mesh_data<vert>(lava::mesh_type::triangle);
+        mesh_data.vertices.assign(vertices + record.first_vertex, vertices + record.first_vertex + record.vertex_count);
+        mesh_data.indices.assign(indices + record.first_index, indices + record.first_index + record.index_count);
+
+        auto m = std::make_shared<lava::mesh_template<vert>>();
+        m->add_data(mesh_data);
+
+        meshes.push_back(m);
+        mesh_names.push_back(std::move(name));
+    }
 
-    for (size_t i = 0; i < ai_scene->mNumMeshes; ++i) {
-        auto *mes = ai_scene->mMeshes[i];
-        read_mesh(mes->mName.C_Str(), mes, meshes);
-        names.emplace_back(mes->mName.C_Str());
+    if (!arena.create(device, sources)) {
+        lava::log()->error("scene: static meshes could not be uploaded");
+        return {{},{}};
     }
-    return {meshes, names};
+    if (arena.empty() && header->mesh_count > 0) {
+        lava::log()->warn("scene: the meshes have no triangles");
+        return {{},{}};
+    }
+    return {meshes, mesh_names};
 }
 
 void scene_importer::populate_scene(scene &scene) {
-    if(ai_scene == nullptr)
+    if(contents.empty())
         return;
 
-    walk_tree(ai_scene, ai_scene->mRootNode, scene, 0);
+    const auto *header = section<cache_header>(contents, 0, 1);
+    const auto *records = section<cache_node>(contents, header->nodes_offset, header->node_count);
+    const auto *names = section<char>(contents, header->names_offset, header->names_size);
+
+    // scene ids of the nodes added so far, parents come first
+    std::vector<uint32_t> ids(header->node_count);
+    for (uint32_t i = 0; i < header->node_count; ++i) {
+        const cache_node &record = records[i];
+        node_payload payload{};
+        node_type type = node_type::base;
+        if (record.mesh_index != NO_INDEX) {
+            type = node_type::mesh;
+            payload.mesh = {
+                    .mesh_index = record.mesh_index
+            };
+        }
+        const std::string_view name(names + record.name_offset, record.name_size);
+        ids[i] = scene.add_node(record.parent == NO_INDEX ? 0 : ids[record.parent], name, record.transform, type, payload);
+    }
 }
 
 lava::mesh_template<vert>::ptr scene_importer::create_empty_mesh(size_t max_triangles){
@@ -2,8 +2,11 @@
 
 #include "types_and_data.hpp"
 #include "scene.hpp"
+#include "mapped_file.hpp"
+#include "mesh_arena.hpp"
 
 #include <liblava/lava.hpp>
+#include <span>
 #include <vector>
 #include <string>
 
@@ -12,28 +15,34 @@
 
 namespace fb{
 
+// Imports a scene with Assimp and converts it into a flat binary form (meshes, node tree and transforms).
+// With a cache path the binary form is also written to disk, keyed by a hash of the source file; later imports
+// of the same source map that file and skip Assimp entirely. A cache that fails validation is imported again.
 class scene_importer{
-    Assimp::Importer importer{};
     lava::device_p device;
-    const aiScene *ai_scene{};
 
-    std::unordered_map<std::string, uint32_t> mesh_ids{};
-    std::unordered_map<std::string, uint32_t> material_ids{};
+    mapped_file cache_file;
+    std::vector<uint8_t> converted{};
+    // the binary form, either mapped from the cache file or just converted; empty without a scene
+    std::span<const uint8_t> contents{};
 
-    void read_mesh(const std::string& name, aiMesh *mesh, lava::mesh_template<vert>::list &meshes);
+    void convert(const aiScene *ai_scene, uint64_t source_hash);
+    bool read_cache(const std::string& path, uint64_t source_hash);
+    void write_cache(const std::string& path) const;
 
-    void walk_tree(const aiScene *aiS, aiNode *aiNode, scene& scene, uint32_t head);
 public:
 
     scene_importer(const std::string& path, lava::device_p device);
 
-    scene_importer(lava::cdata data, lava::device_p device);
+    // cache_path may be empty (no cache)
+    scene_importer(lava::cdata data, lava::device_p device, const std::string& cache_path = {});
 
-    std::pair<lava::mesh_template<vert>::list,std::vector<std::string>> load_meshes();
+    // the meshes are uploaded into arena (mesh i at arena range i), the returned meshes only hold a copy of the data
+    std::pair<lava::mesh_template<vert>::list,std::vector<std::string>> load_meshes(mesh_arena& arena);
 
     lava::mesh_template<vert>::ptr create_empty_mesh(size_t max_triangles);
 
     void populate_scene(scene& scene);
 
 };
-}
\ No newline at end of file
+}
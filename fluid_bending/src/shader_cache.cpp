@@ -0,0 +1,278 @@
+#include "shader_cache.hpp"
+
+#include <shaderc/shaderc.hpp>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+
+namespace fb{
+
+namespace fs = std::filesystem;
+
+namespace {
+    // bump if the compilation changes in a way the key doesn't capture (e.g. shaderc settings below)
+    constexpr uint32_t CACHE_VERSION = 1;
+    constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+    // FNV-1a
+    void hash_bytes(uint64_t& hash, const void* data, size_t size){
+        auto bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    void hash_string(uint64_t& hash, const std::string& s){
+        const uint64_t size = s.size();
+        hash_bytes(hash, &size, sizeof(size));
+        hash_bytes(hash, s.data(), s.size());
+    }
+
+    std::string include_path(const std::string& including_file, const std::string& name){
+        return (fs::path(including_file).parent_path() / name).lexically_normal().generic_string();
+    }
+
+    // the file names of all `#include "..."` directives in source
+    std::vector<std::string> parse_includes(const std::string& source){
+        std::vector<std::string> names;
+        size_t line_start = 0;
+        while (line_start < source.size()) {
+            size_t line_end = source.find('\n', line_start);
+            if (line_end == std::string::npos)
+                line_end = source.size();
+
+            size_t i = source.find_first_not_of(" \t", line_start);
+            if (i < line_end && source.compare(i, 8, "#include") == 0) {
+                const size_t open = source.find('"', i + 8);
+                const size_t close = open < line_end ? source.find('"', open + 1) : std::string::npos;
+                if (close < line_end)
+                    names.push_back(source.substr(open + 1, close - open - 1));
+            }
+            line_start = line_end + 1;
+        }
+        return names;
+    }
+
+    // hashes all files included by file (recursively, each once); conditional includes are hashed as well
+    bool hash_includes(uint64_t& hash, const shader_cache::file_reader& reader, const std::string& file, const std::string& source,
+                       std::unordered_set<std::string>& visited, std::vector<std::string>& dependencies, std::string& error){
+        for (auto& name : parse_includes(source)) {
+            const std::string path = include_path(file, name);
+            if (!visited.insert(path).second)
+                continue;
+
+            std::string content;
+            if (!reader(path, content)) {
+                error = "can't open include " + path + " (from " + file + ")";
+                return false;
+            }
+            dependencies.push_back(path);
+            // the name as written, not the path, so the key doesn't depend on where the files are
+            hash_string(hash, name);
+            hash_string(hash, content);
+            if (!hash_includes(hash, reader, path, content, visited, dependencies, error))
+                return false;
+        }
+        return true;
+    }
+
+    bool shader_kind(const std::string& path, shaderc_shader_kind& kind){
+        static const std::array<std::pair<const char*, shaderc_shader_kind>, 10> kinds{{
+            {".vert", shaderc_vertex_shader},
+            {".frag", shaderc_fragment_shader},
+            {".comp", shaderc_compute_shader},
+            {".geom", shaderc_geometry_shader},
+            {".rgen", shaderc_raygen_shader},
+            {".rmiss", shaderc_miss_shader},
+            {".rchit", shaderc_closesthit_shader},
+            {".rahit", shaderc_anyhit_shader},
+            {".rint", shaderc_intersection_shader},
+            {".rcall", shaderc_callable_shader},
+        }};
+        const std::string extension = fs::path(path).extension().string();
+        for (auto& [ext, k] : kinds) {
+            if (extension == ext) {
+                kind = k;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    class includer : public shaderc::CompileOptions::IncluderInterface{
+        struct result_data{
+            std::string name;
+            std::string content;
+            shaderc_include_result result{};
+        };
+
+        const shader_cache::file_reader& reader;
+
+    public:
+        explicit includer(const shader_cache::file_reader& reader) : reader(reader) {}
+
+        shaderc_include_result* GetInclude(const char* requested_source, shaderc_include_type, const char* requesting_source, size_t) override{
+            auto* data = new result_data;
+            const std::string path = include_path(requesting_source, requested_source);
+            if (reader(path, data->content)) {
+                data->name = path;
+            } else {
+                // an empty name signals the failure, the content is the error message
+                data->content = "can't open " + path;
+            }
+            data->result = {data->name.c_str(), data->name.size(), data->content.c_str(), data->content.size(), data};
+            return &data->result;
+        }
+
+        void ReleaseInclude(shaderc_include_result* result) override{
+            delete static_cast<result_data*>(result->user_data);
+        }
+    };
+
+    bool read_entry(const fs::path& path, std::vector<uint32_t>& spirv){
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+        const auto size = size_t(file.tellg());
+        if (size == 0 || size % sizeof(uint32_t) != 0)
+            return false;
+        spirv.resize(size / sizeof(uint32_t));
+        file.seekg(0);
+        return file.read(reinterpret_cast<char*>(spirv.data()), std::streamsize(size)) && spirv.front() == SPIRV_MAGIC;
+    }
+
+    void write_entry(const fs::path& path, const std::vector<uint32_t>& spirv){
+        std::error_code ec;
+        fs::create_directories(path.parent_path(), ec);
+
+        // entries of older versions of this shader are never used again
+        const std::string prefix = path.stem().stem().string() + ".";
+        for (auto& entry : fs::directory_iterator(path.parent_path(), ec)) {
+            const std::string name = entry.path().filename().string();
+            if (name.starts_with(prefix) && entry.path().extension() == ".spv" && entry.path() != path)
+                fs::remove(entry.path(), ec);
+        }
+
+        // write and rename, so a concurrent reader never sees a partial entry
+        const fs::path temp = path.string() + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            if (!file)
+                return;
+            file.write(reinterpret_cast<const char*>(spirv.data()), std::streamsize(spirv.size() * sizeof(uint32_t)));
+        }
+        fs::rename(temp, path, ec);
+    }
+}
+
+shader_cache::shader_cache(std::string cache_directory, file_reader reader, shader_options compile_options)
+    : directory(std::move(cache_directory)), reader(std::move(reader)), compile_options(std::move(compile_options)) {}
+
+bool shader_cache::get_key(const std::string& path, uint64_t& key, std::string& error) const {
+    std::string source;
+    std::vector<std::string> files;
+    return compute_key(path, source, key, files, error);
+}
+
+bool shader_cache::compute_key(const std::string& path, std::string& source, uint64_t& key, std::vector<std::string>& files,
+                               std::string& error) const {
+    error.clear();
+
+    if (!reader(path, source)) {
+        error = "can't open " + path;
+        return false;
+    }
+
+    key = 14695981039346656037ull;
+    hash_bytes(key, &CACHE_VERSION, sizeof(CACHE_VERSION));
+    hash_string(key, source);
+
+    std::unordered_set<std::string> visited;
+    files = {path};
+    if (!hash_includes(key, reader, path, source, visited, files, error))
+        return false;
+
+    const uint8_t flags = (compile_options.debug ? 1 : 0) | (compile_options.optimize ? 2 : 0);
+    hash_bytes(key, &flags, sizeof(flags));
+    for (auto& [name, value] : compile_options.defines) {
+        hash_string(key, name);
+        hash_string(key, value);
+    }
+    return true;
+}
+
+const std::vector<uint32_t>* shader_cache::get(const std::string& path, std::string& error, std::vector<std::string>* dependencies,
+                                               uint64_t* compiled_key) {
+    std::string source;
+    uint64_t key;
+    std::vector<std::string> files;
+    if (compiled_key)
+        *compiled_key = 0;
+    if (!compute_key(path, source, key, files, error))
+        return nullptr;
+
+    if (dependencies)
+        *dependencies = files;
+    if (compiled_key)
+        *compiled_key = key;
+
+    std::array<char, 17> key_string{};
+    std::snprintf(key_string.data(), key_string.size(), "%016llx", static_cast<unsigned long long>(key));
+    const fs::path entry = fs::path(directory) / (fs::path(path).filename().string() + "." + key_string.data() + ".spv");
+    const std::string loaded_key = entry.filename().string();
+
+    {
+        std::lock_guard lock(mutex);
+        if (auto it = loaded.find(loaded_key); it != loaded.end())
+            return &it->second;
+    }
+
+    std::vector<uint32_t> spirv;
+    bool compiled = false;
+    if (!read_entry(entry, spirv)) {
+        if (!compile(path, source, spirv, error))
+            return nullptr;
+        compiled = true;
+        std::lock_guard lock(write_mutex);
+        write_entry(entry, spirv);
+    }
+
+    // if another thread loaded the same entry in the meantime, its (identical) SPIR-V is kept
+    std::lock_guard lock(mutex);
+    if (compiled)
+        compile_count++;
+    return &loaded.try_emplace(loaded_key, std::move(spirv)).first->second;
+}
+
+bool shader_cache::compile(const std::string& path, const std::string& source, std::vector<uint32_t>& spirv, std::string& error) const {
+    shaderc_shader_kind kind;
+    if (!shader_kind(path, kind)) {
+        error = "unknown shader stage of " + path;
+        return false;
+    }
+
+    shaderc::CompileOptions options;
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+    options.SetTargetSpirv(shaderc_spirv_version_1_5);
+    if (compile_options.debug)
+        options.SetGenerateDebugInfo();
+    options.SetOptimizationLevel(compile_options.optimize ? shaderc_optimization_level_performance : shaderc_optimization_level_zero);
+    for (auto& [name, value] : compile_options.defines)
+        options.AddMacroDefinition(name, value);
+    options.SetIncluder(std::make_unique<includer>(reader));
+
+    shaderc::Compiler compiler;
+    const auto result = compiler.CompileGlslToSpv(source, kind, path.c_str(), options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+        error = result.GetErrorMessage();
+        return false;
+    }
+    spirv.assign(result.cbegin(), result.cend());
+    return true;
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fb{
+
+// part of the cache key, so changing them never reuses entries compiled with other options
+struct shader_options{
+    bool debug = true;
+    bool optimize = true;
+    std::vector<std::pair<std::string, std::string>> defines{};
+};
+
+// SPIR-V of the glsl shaders, cached on disk as <cache_directory>/<file name>.<key>.spv.
+// The key is a hash of the source, all (recursively) included files and the compile options,
+// so an entry is only reused if nothing that goes into the compilation changed.
+// fb_shader_builder fills the cache at build time, then a cold start does not run shaderc at all;
+// shaders edited after the build are compiled once at runtime and added to the cache.
+// get is thread safe, so pipelines can be created concurrently; the returned SPIR-V stays valid until clear.
+// Intentionally independent of liblava, the builder links only shaderc.
+class shader_cache{
+public:
+    using ptr = std::shared_ptr<shader_cache>;
+
+    // reads the file at path (relative paths are resolved by the reader); false if it doesn't exist
+    using file_reader = std::function<bool(const std::string& path, std::string& content)>;
+
+    shader_cache(std::string cache_directory, file_reader reader, shader_options compile_options = {});
+
+    // SPIR-V of the shader at path (stage from the file extension); nullptr on error (message in error).
+    // dependencies receives the shader and all included files, key the key of the sources that were read (also if
+    // compiling them failed, 0 if they couldn't be read), so it matches the SPIR-V even if a file is edited right after.
+    const std::vector<uint32_t>* get(const std::string& path, std::string& error, std::vector<std::string>* dependencies = nullptr,
+                                     uint64_t* key = nullptr);
+
+    // hash of everything that goes into the compilation of the shader at path (source, includes, options);
+    // cheap compared to get, used to notice edited shaders
+    bool get_key(const std::string& path, uint64_t& key, std::string& error) const;
+
+    // number of shaders that had to be compiled (cache misses) since creation
+    [[nodiscard]] inline uint32_t get_compile_count() const{
+        std::lock_guard lock(mutex);
+        return compile_count;
+    }
+
+    // must not run concurrently with get
+    inline void clear(){
+        std::lock_guard lock(mutex);
+        loaded.clear();
+    }
+
+    inline static ptr make(std::string cache_directory, file_reader reader, shader_options compile_options = {}){
+        return std::make_shared<shader_cache>(std::move(cache_directory), std::move(reader), std::move(compile_options));
+    }
+
+private:
+    std::string directory;
+    file_reader reader;
+    shader_options compile_options;
+
+    // guards loaded and compile_count; reading, hashing and compiling run unlocked
+    mutable std::mutex mutex;
+    // serializes writing entries (which also removes older entries of the same shader)
+    std::mutex write_mutex;
+    std::unordered_map<std::string, std::vector<uint32_t>> loaded;
+    uint32_t compile_count = 0;
+
+    bool compute_key(const std::string& path, std::string& source, uint64_t& key, std::vector<std::string>& files,
+                     std::string& error) const;
+    bool compile(const std::string& path, const std::string& source, std::vector<uint32_t>& spirv, std::string& error) const;
+};
+
+}
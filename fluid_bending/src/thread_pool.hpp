@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace fb{
+
+// Fixed set of worker threads that run the submitted jobs in submission order, used to create the pipelines
+// (and with them compile the shader modules) concurrently while the main thread keeps loading the scene.
+// The destructor runs the remaining jobs before joining the workers.
+class thread_pool{
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable job_available;
+    bool stopping = false;
+
+public:
+    using ptr = std::shared_ptr<thread_pool>;
+
+    // 0 uses one thread less than there are cores, the main thread has work of its own
+    explicit thread_pool(uint32_t thread_count = 0){
+        if (thread_count == 0)
+            thread_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        workers.reserve(thread_count);
+        for (uint32_t i = 0; i < thread_count; i++)
+            workers.emplace_back([this] { run(); });
+    }
+
+    ~thread_pool(){
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        job_available.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // the future holds the result of job (or rethrows its exception)
+    template<typename F>
+    auto submit(F&& job) -> std::future<std::invoke_result_t<F>>{
+        using result = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<result()>>(std::forward<F>(job));
+        auto future = task->get_future();
+        {
+            std::lock_guard lock(mutex);
+            jobs.emplace([task] { (*task)(); });
+        }
+        job_available.notify_one();
+        return future;
+    }
+
+    [[nodiscard]] inline uint32_t get_thread_count() const{
+        return uint32_t(workers.size());
+    }
+
+    inline static ptr make(uint32_t thread_count = 0){
+        return std::make_shared<thread_pool>(thread_count);
+    }
+
+private:
+    void run(){
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(mutex);
+                job_available.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+};
+
+}
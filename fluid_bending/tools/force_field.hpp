@@ -0,0 +1,182 @@
+#pragma once
+
+// Field primitives for fb_force_field_baker, the native counterpart of tools/create_force_field.py
+// (same names, defaults and results, up to float rounding).
+//
+// A field is evaluated for a whole z row of the grid at once. The rows are structures of arrays and every
+// primitive is a branch free loop over them, so the compiler vectorises it; the conditional fields
+// (choose_sphere, spring) evaluate both sides and select per lane.
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace fb::force_field{
+
+// grid points per side, matches core::SIDE_FORCE_FIELD_SIZE
+constexpr uint32_t SIDE = 16 * 8 + 1;
+constexpr float DAMP = 0.3f;
+
+// positions of one row, in [0, 1]
+struct row{
+    alignas(32) std::array<float, SIDE> x;
+    alignas(32) std::array<float, SIDE> y;
+    alignas(32) std::array<float, SIDE> z;
+};
+
+// force (xyz) and dampening (w) of one row
+struct forces{
+    alignas(32) std::array<float, SIDE> x;
+    alignas(32) std::array<float, SIDE> y;
+    alignas(32) std::array<float, SIDE> z;
+    alignas(32) std::array<float, SIDE> w;
+};
+
+struct point{
+    float x, y, z;
+};
+
+using field = std::function<void(const row&, forces&)>;
+
+inline field constant(float x, float y, float z, float w = DAMP){
+    return [=](const row&, forces& out) {
+        out.x.fill(x);
+        out.y.fill(y);
+        out.z.fill(z);
+        out.w.fill(w);
+    };
+}
+
+inline field zero(float d = 0.f){
+    return constant(0.f, 0.f, 0.f, d);
+}
+
+inline field gravity(float d = 0.f){
+    return constant(0.f, -9.81f, 0.f, d);
+}
+
+// like the python versions the dampening is scaled by 2 * strength as well
+inline field rotation_x(float strength = 1.f, float d = DAMP){
+    return [=](const row& p, forces& out) {
+        for (uint32_t i = 0; i < SIDE; i++) {
+            out.x[i] = 0.f;
+            out.y[i] = (p.z[i] - 0.5f) * 2.f * strength;
+            out.z[i] = -(p.y[i] - 0.5f) * 2.f * strength;
+            out.w[i] = d * 2.f * strength;
+        }
+    };
+}
+
+inline field rotation_y(float strength = 1.f, float d = DAMP){
+    return [=](const row& p, forces& out) {
+        for (uint32_t i = 0; i < SIDE; i++) {
+            out.x[i] = (p.z[i] - 0.5f) * 2.f * strength;
+            out.y[i] = 0.f;
+            out.z[i] = -(p.x[i] - 0.5f) * 2.f * strength;
+            out.w[i] = d * 2.f * strength;
+        }
+    };
+}
+
+inline field rotation_z(float strength = 1.f, float d = DAMP){
+    return [=](const row& p, forces& out) {
+        for (uint32_t i = 0; i < SIDE; i++) {
+            out.x[i] = (p.y[i] - 0.5f) * 2.f * strength;
+            out.y[i] = -(p.x[i] - 0.5f) * 2.f * strength;
+            out.z[i] = 0.f;
+            out.w[i] = d * 2.f * strength;
+        }
+    };
+}
+
+// normalized(center - pos) * strength
+inline field force_towards(point center, float strength = 1.f, float d = DAMP){
+    return [=](const row& p, forces& out) {
+        for (uint32_t i = 0; i < SIDE; i++) {
+            const float dx = center.x - p.x[i];
+            const float dy = center.y - p.y[i];
+            const float dz = center.z - p.z[i];
+            const float scale = strength / (std::sqrt(dx * dx + dy * dy + dz * dz) + 0.000001f);
+            out.x[i] = dx * scale;
+            out.y[i] = dy * scale;
+            out.z[i] = dz * scale;
+            out.w[i] = d;
+        }
+    };
+}
+
+// inside for positions closer than radius to center, outside otherwise
+inline field choose_sphere(point center, field inside, field outside, float radius = 0.25f){
+    return [=, inside = std::move(inside), outside = std::move(outside)](const row& p, forces& out) {
+        forces in_forces;
+        inside(p, in_forces);
+        outside(p, out);
+        for (uint32_t i = 0; i < SIDE; i++) {
+            const float dx = p.x[i] - center.x;
+            const float dy = p.y[i] - center.y;
+            const float dz = p.z[i] - center.z;
+            const bool in = std::sqrt(dx * dx + dy * dy + dz * dz) < radius;
+            out.x[i] = in ? in_forces.x[i] : out.x[i];
+            out.y[i] = in ? in_forces.y[i] : out.y[i];
+            out.z[i] = in ? in_forces.z[i] : out.z[i];
+            out.w[i] = in ? in_forces.w[i] : out.w[i];
+        }
+    };
+}
+
+// fountain in the middle of the floor: pulls inwards close to the jet, pushes up in it and sideways at the top
+inline field spring(field environment = gravity()){
+    return [environment = std::move(environment)](const row& p, forces& out) {
+        environment(p, out);
+        for (uint32_t i = 0; i < SIDE; i++) {
+            const float dx = p.x[i] - 0.5f;
+            const float dz = p.z[i] - 0.5f;
+            const float center_dist = std::sqrt(dx * dx + dz * dz);
+            // -normalized(P(x, 0, z) - P(0.5, 0, 0.5))
+            const float inward_x = -dx / (center_dist + 0.000001f);
+            const float inward_z = -dz / (center_dist + 0.000001f);
+
+            float x, y, z, w;
+            if (center_dist > 0.05f) {
+                const float pull = p.y[i] > 0.2f ? 0.f : 2.f;
+                x = out.x[i] + inward_x * pull;
+                y = out.y[i];
+                z = out.z[i] + inward_z * pull;
+                w = out.w[i];
+            } else if (center_dist > 0.03f) {
+                x = inward_x * 100.f;
+                y = 0.f;
+                z = inward_z * 100.f;
+                w = DAMP * 0.1f * 100.f;
+            } else {
+                x = 0.f;
+                y = 10.f;
+                z = 0.f;
+                w = 0.f;
+            }
+            const bool top = p.y[i] > 0.5f;
+            out.x[i] = top ? 6.f : x;
+            out.y[i] = top ? -12.f : y;
+            out.z[i] = top ? 0.f : z;
+            out.w[i] = top ? DAMP : w;
+        }
+    };
+}
+
+inline field operator+(field a, field b){
+    return [a = std::move(a), b = std::move(b)](const row& p, forces& out) {
+        forces other;
+        a(p, out);
+        b(p, other);
+        for (uint32_t i = 0; i < SIDE; i++) {
+            out.x[i] += other.x[i];
+            out.y[i] += other.y[i];
+            out.z[i] += other.z[i];
+            out.w[i] += other.w[i];
+        }
+    };
+}
+
+}
@@ -0,0 +1,430 @@
+// Bakes the force field animation (res/force_fields/field.bin) that force_field_stream plays, by default brick
+// compressed (src/force_field_format.hpp), with --raw in the legacy layout: frames * SIDE^3 grid points of 4 floats
+// (force xyz, dampening w), x outermost, z innermost.
+// The frames are the ones of tools/create_force_field.py, built from the primitives in force_field.hpp.
+//
+// usage: fb_force_field_baker <output file> [--raw] [thread count]
+
+#include "force_field.hpp"
+#include "../src/force_field_format.hpp"
+#include "../src/thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace fb::force_field;
+namespace format = fb::force_field_format;
+
+namespace {
+    field collecting_sphere(float height, field inner = gravity()){
+        const point center{0.5f, height, 0.5f};
+        return choose_sphere(center, std::move(inner), force_towards(center, 30.f, 4.f));
+    }
+
+    std::vector<field> animation(){
+        std::vector<field> frames{
+                zero(),
+                gravity(),
+                spring(),
+                gravity(),
+                gravity(),
+                collecting_sphere(0.25f),
+                collecting_sphere(0.25f * 1.25f),
+                collecting_sphere(0.25f * 1.5f),
+                collecting_sphere(0.25f * 1.75f),
+                collecting_sphere(0.5f),
+                collecting_sphere(0.5f, rotation_y(10.f) + gravity()),
+                collecting_sphere(0.5f, rotation_y(30.f, 0.f) + gravity()),
+        };
+        for (uint32_t i = 0; i < 4; i++)
+            frames.push_back(collecting_sphere(0.5f, rotation_y(50.f, 0.f) + gravity()));
+        for (uint32_t i = 0; i < 4; i++)
+            frames.push_back(collecting_sphere(0.5f, rotation_z(50.f, 0.f) + gravity()));
+        for (uint32_t i = 0; i < 4; i++)
+            frames.push_back(collecting_sphere(0.5f, rotation_x(50.f, 0.f) + gravity()));
+        frames.push_back(gravity());
+        return frames;
+    }
+
+    // fills the x slab of a frame (SIDE * SIDE points) row by row
+    void bake_slab(const field& frame, uint32_t x, float* slab){
+        row positions;
+        forces result;
+        positions.x.fill(float(x) / float(SIDE - 1));
+        for (uint32_t z = 0; z < SIDE; z++)
+            positions.z[z] = float(z) / float(SIDE - 1);
+
+        for (uint32_t y = 0; y < SIDE; y++) {
+            positions.y.fill(float(y) / float(SIDE - 1));
+            frame(positions, result);
+            float* out = slab + size_t(y) * SIDE * 4;
+            for (uint32_t z = 0; z < SIDE; z++) {
+                out[z * 4 + 0] = result.x[z];
+                out[z * 4 + 1] = result.y[z];
+                out[z * 4 + 2] = result.z[z];
+                out[z * 4 + 3] = result.w[z];
+            }
+        }
+    }
+
+    // round to nearest even, like the conversion of a gpu
+    uint16_t float_to_half(float value){
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint32_t sign = (bits >> 16) & 0x8000;
+        const uint32_t float_exponent = (bits >> 23) & 0xff;
+        uint32_t mantissa = bits & 0x7fffff;
+        if (float_exponent == 0xff)
+            return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+        const int32_t exponent = int32_t(float_exponent) - 127 + 15;
+        if (exponent >= 31)
+            return uint16_t(sign | 0x7c00);
+        uint32_t shift = 13;
+        uint32_t half = (uint32_t(std::max(exponent, 0)) << 10);
+        if (exponent <= 0) {
+            // subnormal
+            if (exponent < -10)
+                return uint16_t(sign);
+            mantissa |= 0x800000;
+            shift = uint32_t(14 - exponent);
+        }
+        half |= mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        // a carry into the exponent is the correct rounding (up to infinity)
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return uint16_t(sign | half);
+    }
+
+    uint32_t float_bits(float value){
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    float bits_float(uint32_t bits){
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // error of quantized bricks relative to the largest force or dampening of the brick
+    constexpr float QUANTIZATION_TOLERANCE = 1.f / 512.f;
+
+    // position of brick point i (x outermost)
+    std::array<float, 3> local_position(uint32_t i){
+        return {float(i / 64), float(i / 8 % 8), float(i % 8)};
+    }
+
+    // bit counts, minimum, step and gradient of each component of a quantized brick
+    struct quantization{
+        std::array<uint32_t, 4> bits{};
+        std::array<float, 4> minimum{};
+        std::array<float, 4> step{};
+        std::array<std::array<float, 3>, 4> gradient{};
+        bool has_gradient = false;
+
+        [[nodiscard]] uint32_t point_bits() const{
+            return bits[0] + bits[1] + bits[2] + bits[3];
+        }
+
+        // in words, with the descriptor, minimum, step and gradient
+        [[nodiscard]] uint32_t size() const{
+            return 9 + (has_gradient ? 12 : 0) + format::BRICK_POINTS * point_bits() / 32;
+        }
+
+        [[nodiscard]] float prediction(uint32_t c, uint32_t i) const{
+            const auto p = local_position(i);
+            return has_gradient ? gradient[c][0] * p[0] + gradient[c][1] * p[1] + gradient[c][2] * p[2] : 0.f;
+        }
+    };
+
+    // Picks the fewest bits per component that keep every point within QUANTIZATION_TOLERANCE of the largest
+    // force (xyz) or dampening (w) of the brick; components constant over the brick take no bits. With a gradient
+    // only the difference to a linear fit of the brick is quantized, which is smaller wherever the field is smooth.
+    // Only the points inside the grid (local positions below valid) count. False for values that aren't finite.
+    bool plan_quantization(const std::vector<std::array<uint32_t, 4>>& points, const std::array<uint32_t, 3>& valid,
+                           bool with_gradient, quantization& plan){
+        auto for_valid = [&](auto&& f) {
+            for (uint32_t x = 0; x < valid[0]; x++)
+                for (uint32_t y = 0; y < valid[1]; y++)
+                    for (uint32_t z = 0; z < valid[2]; z++)
+                        f((x * format::BRICK_SIZE + y) * format::BRICK_SIZE + z);
+        };
+        for (auto& point : points) {
+            for (uint32_t bits : point) {
+                if (!std::isfinite(bits_float(bits)))
+                    return false;
+            }
+        }
+        float force = 0.f;
+        float dampening = 0.f;
+        for_valid([&](uint32_t i) {
+            for (uint32_t c = 0; c < 3; c++)
+                force = std::max(force, std::abs(bits_float(points[i][c])));
+            dampening = std::max(dampening, std::abs(bits_float(points[i][3])));
+        });
+
+        plan.has_gradient = with_gradient;
+        for (uint32_t c = 0; c < 4; c++) {
+            // least squares fit; the valid points are a box, so the axes are independent
+            plan.gradient[c] = {};
+            if (with_gradient) {
+                const double count = double(valid[0]) * valid[1] * valid[2];
+                double mean = 0.;
+                for_valid([&](uint32_t i) { mean += bits_float(points[i][c]); });
+                mean /= count;
+                std::array<double, 3> covariance{}, variance{};
+                for_valid([&](uint32_t i) {
+                    const auto p = local_position(i);
+                    const double value = bits_float(points[i][c]) - mean;
+                    for (uint32_t axis = 0; axis < 3; axis++) {
+                        const double d = p[axis] - double(valid[axis] - 1) * 0.5;
+                        covariance[axis] += d * value;
+                        variance[axis] += d * d;
+                    }
+                });
+                for (uint32_t axis = 0; axis < 3; axis++)
+                    plan.gradient[c][axis] = variance[axis] > 0. ? float(covariance[axis] / variance[axis]) : 0.f;
+            }
+
+            float low = INFINITY;
+            float high = -INFINITY;
+            for_valid([&](uint32_t i) {
+                const float residual = bits_float(points[i][c]) - plan.prediction(c, i);
+                low = std::min(low, residual);
+                high = std::max(high, residual);
+            });
+            const float range = high - low;
+            const float tolerance = (c < 3 ? force : dampening) * QUANTIZATION_TOLERANCE;
+            uint32_t bits = 0;
+            // the error is half a step
+            while (range > 0.f && bits < format::MAX_QUANTIZED_BITS && range / float((2u << bits) - 2u) > tolerance)
+                bits++;
+            plan.bits[c] = bits;
+            plan.minimum[c] = low;
+            plan.step[c] = bits > 0 ? range / float((1u << bits) - 1u) : 0.f;
+        }
+        return true;
+    }
+
+    // appends the points as a stream of plan.point_bits() per point, components in order, lowest bits first
+    void write_quantized(const std::vector<std::array<uint32_t, 4>>& points, const quantization& plan,
+                         std::vector<uint32_t>& data){
+        data.push_back(plan.bits[0] | plan.bits[1] << 5 | plan.bits[2] << 10 | plan.bits[3] << 15 |
+                       (plan.has_gradient ? format::QUANTIZED_GRADIENT_BIT : 0u));
+        for (float minimum : plan.minimum)
+            data.push_back(float_bits(minimum));
+        for (float step : plan.step)
+            data.push_back(float_bits(step));
+        for (uint32_t c = 0; c < 4 && plan.has_gradient; c++) {
+            for (float g : plan.gradient[c])
+                data.push_back(float_bits(g));
+        }
+
+        const size_t stream = data.size();
+        data.resize(stream + format::BRICK_POINTS * plan.point_bits() / 32, 0u);
+        uint64_t position = 0;
+        for (uint32_t i = 0; i < format::BRICK_POINTS; i++) {
+            for (uint32_t c = 0; c < 4; c++) {
+                const uint32_t bits = plan.bits[c];
+                if (bits == 0)
+                    continue;
+                const float max_value = float((1u << bits) - 1u);
+                const float residual = bits_float(points[i][c]) - plan.prediction(c, i);
+                const float value = std::clamp(std::round((residual - plan.minimum[c]) / plan.step[c]), 0.f, max_value);
+                const uint64_t shifted = uint64_t(value) << (position % 32);
+                data[stream + position / 32] |= uint32_t(shifted);
+                if ((position % 32) + bits > 32)
+                    data[stream + position / 32 + 1] |= uint32_t(shifted >> 32);
+                position += bits;
+            }
+        }
+    }
+
+    // encodes the bricks with x index brick_x: a header word per brick (offset relative to data) and their data
+    void encode_slab(const float* frame, uint32_t brick_x, uint32_t* headers, std::vector<uint32_t>& data){
+        constexpr uint32_t bricks_per_side = format::get_bricks_per_side(SIDE);
+        std::vector<std::array<uint32_t, 4>> points(format::BRICK_POINTS);
+        std::vector<std::array<uint32_t, 4>> palette;
+        std::vector<uint32_t> indices(format::BRICK_POINTS);
+        quantization plan;
+        quantization linear_plan;
+        data.clear();
+
+        for (uint32_t brick_y = 0; brick_y < bricks_per_side; brick_y++) {
+            for (uint32_t brick_z = 0; brick_z < bricks_per_side; brick_z++) {
+                // points past the edge repeat the edge, so they don't break up constant bricks
+                for (uint32_t i = 0; i < format::BRICK_POINTS; i++) {
+                    const uint32_t x = std::min(brick_x * format::BRICK_SIZE + i / 64, SIDE - 1);
+                    const uint32_t y = std::min(brick_y * format::BRICK_SIZE + i / 8 % 8, SIDE - 1);
+                    const uint32_t z = std::min(brick_z * format::BRICK_SIZE + i % 8, SIDE - 1);
+                    const float* point = frame + ((size_t(x) * SIDE + y) * SIDE + z) * 4;
+                    points[i] = {float_bits(point[0]), float_bits(point[1]), float_bits(point[2]), float_bits(point[3])};
+                }
+
+                palette.clear();
+                for (uint32_t i = 0; i < format::BRICK_POINTS && palette.size() <= format::MAX_PALETTE_SIZE; i++) {
+                    auto entry = std::find(palette.begin(), palette.end(), points[i]);
+                    indices[i] = uint32_t(entry - palette.begin());
+                    if (entry == palette.end())
+                        palette.push_back(points[i]);
+                }
+                const bool fits_palette = palette.size() <= format::MAX_PALETTE_SIZE;
+                const std::array<uint32_t, 3> valid = {
+                        std::min(format::BRICK_SIZE, SIDE - brick_x * format::BRICK_SIZE),
+                        std::min(format::BRICK_SIZE, SIDE - brick_y * format::BRICK_SIZE),
+                        std::min(format::BRICK_SIZE, SIDE - brick_z * format::BRICK_SIZE)};
+                const bool fits_quantized = plan_quantization(points, valid, false, plan);
+                if (fits_quantized && plan_quantization(points, valid, true, linear_plan) && linear_plan.size() < plan.size())
+                    plan = linear_plan;
+                // the palette is exact, so it is kept unless quantizing is smaller
+                const auto palette_size = uint32_t(format::BRICK_POINTS / 8 + palette.size() * 4);
+
+                const auto offset = uint32_t(data.size());
+                uint32_t type;
+                if (palette.size() == 1) {
+                    type = format::constant;
+                    data.insert(data.end(), palette[0].begin(), palette[0].end());
+                } else if (fits_palette && (!fits_quantized || palette_size <= plan.size())) {
+                    type = format::palette;
+                    for (uint32_t i = 0; i < format::BRICK_POINTS; i += 8) {
+                        uint32_t word = 0;
+                        for (uint32_t j = 0; j < 8; j++)
+                            word |= indices[i + j] << (j * 4);
+                        data.push_back(word);
+                    }
+                    for (auto& entry : palette)
+                        data.insert(data.end(), entry.begin(), entry.end());
+                } else if (fits_quantized) {
+                    type = format::quantized;
+                    write_quantized(points, plan, data);
+                } else {
+                    type = format::half;
+                    for (auto& point : points) {
+                        float value[4];
+                        std::memcpy(value, point.data(), sizeof(value));
+                        data.push_back(uint32_t(float_to_half(value[0])) | uint32_t(float_to_half(value[1])) << 16);
+                        data.push_back(uint32_t(float_to_half(value[2])) | uint32_t(float_to_half(value[3])) << 16);
+                    }
+                }
+                headers[brick_y * bricks_per_side + brick_z] = offset << 2 | type;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv){
+    std::vector<std::string> args(argv + 1, argv + argc);
+    const auto raw_flag = std::find(args.begin(), args.end(), "--raw");
+    const bool raw = raw_flag != args.end();
+    if (raw)
+        args.erase(raw_flag);
+    if (args.size() != 1 && args.size() != 2) {
+        std::cerr << "usage: fb_force_field_baker <output file> [--raw] [thread count]\n";
+        return 2;
+    }
+    const std::string& path = args[0];
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "can't write " << path << "\n";
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto frames = animation();
+    fb::thread_pool workers(args.size() == 2 ? uint32_t(std::strtoul(args[1].c_str(), nullptr, 10)) : 0);
+
+    // the frame table is rewritten once the frame sizes are known
+    format::file_header header{
+            .side_size = SIDE,
+            .frame_count = uint32_t(frames.size()),
+    };
+    std::vector<format::frame_entry> frame_table(frames.size());
+    uint64_t offset = 0;
+    auto write = [&](const void* data, size_t size) {
+        file.write(static_cast<const char*>(data), std::streamsize(size));
+        offset += size;
+        return bool(file);
+    };
+    auto align = [&]() {
+        static constexpr char padding[16] = {};
+        return write(padding, (16 - offset % 16) % 16);
+    };
+    if (!raw && !(write(&header, sizeof(header)) && write(frame_table.data(), frame_table.size() * sizeof(format::frame_entry))))
+        return 1;
+
+    constexpr uint32_t bricks_per_side = format::get_bricks_per_side(SIDE);
+    constexpr size_t slab_size = size_t(SIDE) * SIDE * 4;
+    std::vector<float> frame_data(slab_size * SIDE);
+    std::vector<uint32_t> brick_headers(bricks_per_side * bricks_per_side * bricks_per_side);
+    std::vector<std::vector<uint32_t>> brick_data(bricks_per_side);
+    std::vector<std::future<void>> jobs;
+    uint64_t total_size = 0;
+    for (size_t f = 0; f < frames.size(); f++) {
+        jobs.clear();
+        for (uint32_t x = 0; x < SIDE; x++)
+            jobs.push_back(workers.submit([&, f, x] { bake_slab(frames[f], x, frame_data.data() + x * slab_size); }));
+        for (auto& job : jobs)
+            job.get();
+
+        bool written;
+        if (raw) {
+            written = write(frame_data.data(), frame_data.size() * sizeof(float));
+        } else {
+            jobs.clear();
+            for (uint32_t x = 0; x < bricks_per_side; x++) {
+                jobs.push_back(workers.submit([&, x] {
+                    encode_slab(frame_data.data(), x, brick_headers.data() + x * bricks_per_side * bricks_per_side, brick_data[x]);
+                }));
+            }
+            for (auto& job : jobs)
+                job.get();
+
+            // the offsets become relative to the frame start
+            auto data_offset = uint32_t(brick_headers.size());
+            for (uint32_t x = 0; x < bricks_per_side; x++) {
+                for (uint32_t i = 0; i < bricks_per_side * bricks_per_side; i++)
+                    brick_headers[x * bricks_per_side * bricks_per_side + i] += data_offset << 2;
+                data_offset += uint32_t(brick_data[x].size());
+            }
+
+            written = align();
+            frame_table[f] = {.offset = offset, .size = uint64_t(data_offset) * sizeof(uint32_t)};
+            header.max_frame_size = std::max(header.max_frame_size, uint32_t(frame_table[f].size));
+            written = written && write(brick_headers.data(), brick_headers.size() * sizeof(uint32_t));
+            for (auto& data : brick_data)
+                written = written && write(data.data(), data.size() * sizeof(uint32_t));
+        }
+        if (!written) {
+            std::cerr << "can't write " << path << "\n";
+            return 1;
+        }
+        total_size = offset;
+        std::cout << f + 1 << "/" << frames.size() << "\n";
+    }
+
+    if (!raw) {
+        file.seekp(0);
+        offset = 0;
+        if (!(write(&header, sizeof(header)) && write(frame_table.data(), frame_table.size() * sizeof(format::frame_entry)))) {
+            std::cerr << "can't write " << path << "\n";
+            return 1;
+        }
+    }
+
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cout << "baked " << frames.size() << " frames (" << (total_size >> 20) << " MB, " << (raw ? "raw" : "bricks")
+              << ") on " << workers.get_thread_count() << " threads in " << duration.count() << "s\n";
+    return 0;
+}
@@ -0,0 +1,62 @@
+// Build step of the shader cache: compiles one shader into the cache directory (if its entry is missing)
+// and writes a depfile listing the shader and all its includes, so the build system only reruns it for
+// shaders whose sources changed.
+//
+// usage: fb_shader_builder <shader> <cache directory> <stamp file>
+//        the depfile is written to <stamp file>.d
+
+#include "../src/shader_cache.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+    bool read_file(const std::string& path, std::string& content){
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        std::ostringstream stream;
+        stream << file.rdbuf();
+        content = stream.str();
+        return true;
+    }
+
+    std::string escape_depfile_path(const std::string& path){
+        std::string escaped;
+        for (char c : path) {
+            if (c == ' ' || c == '#')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+}
+
+int main(int argc, char** argv){
+    if (argc != 4) {
+        std::cerr << "usage: fb_shader_builder <shader> <cache directory> <stamp file>\n";
+        return 2;
+    }
+    const std::string shader = argv[1];
+    const std::string stamp = argv[3];
+
+    // same options as the application, otherwise the keys don't match
+    fb::shader_cache cache(argv[2], read_file, fb::shader_options{});
+
+    std::string error;
+    std::vector<std::string> dependencies;
+    if (!cache.get(shader, error, &dependencies)) {
+        std::cerr << shader << ": " << error << "\n";
+        return 1;
+    }
+
+    std::ofstream depfile(stamp + ".d", std::ios::trunc);
+    depfile << escape_depfile_path(stamp) << ":";
+    for (auto& dependency : dependencies)
+        depfile << " \\\n  " << escape_depfile_path(dependency);
+    depfile << "\n";
+
+    std::ofstream(stamp, std::ios::trunc) << "\n";
+    return 0;
+}
@@ -0,0 +1,263 @@
+// Times the instance bookkeeping of rtt_extension::tlas on the cpu: the id -> index map, the dense instance arrays
+// and the dirty bits, without any vulkan calls. The old path (std::map ids, std::set of deleted indices compacted by
+// defragment() before each build) is reproduced here next to the slot_map one tlas uses now.
+//
+// usage: fb_tlas_bookkeeping_bench [instance count] [update rounds]
+
+#include "../../liblava_rtt_extension/src/slot_map.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+    // stand-ins of the same size as VkAccelerationStructureInstanceKHR and a small instance_data
+    struct as_instance{
+        std::array<float, 12> transform{};
+        uint32_t custom_index_mask = 0;
+        uint32_t offset_flags = 0;
+        uint64_t reference = 0;
+    };
+    static_assert(sizeof(as_instance) == 64);
+
+    struct instance_data{
+        uint32_t mesh = 0;
+        uint32_t material = 0;
+        uint32_t flags = 0;
+        uint32_t padding = 0;
+    };
+
+    // what both paths share: dense arrays and per instance dirty bits, drained like upload_dirty_instances does
+    struct instance_arrays{
+        std::vector<as_instance> instances;
+        std::vector<instance_data> data;
+        std::vector<uint64_t> ids;
+        std::vector<uint8_t> dirty;
+        std::vector<uint32_t> dirty_indices;
+        uint32_t next_index = 0;
+
+        explicit instance_arrays(uint32_t max_instances)
+            : instances(max_instances), data(max_instances), ids(max_instances), dirty(max_instances){}
+
+        void mark_dirty(uint32_t index, uint8_t bits){
+            if(bits == 0)
+                return;
+            if(dirty[index] == 0)
+                dirty_indices.push_back(index);
+            dirty[index] |= bits;
+        }
+
+        // returns the number of dirty instances so the work can't be optimised away
+        size_t upload(){
+            std::sort(dirty_indices.begin(), dirty_indices.end());
+            const size_t count = dirty_indices.size();
+            for(auto index : dirty_indices)
+                dirty[index] = 0;
+            dirty_indices.clear();
+            return count;
+        }
+    };
+
+    class map_bookkeeping{
+    public:
+        explicit map_bookkeeping(uint32_t max_instances) : arrays(max_instances){}
+
+        uint64_t add(const as_instance& instance, const instance_data& d){
+            uint32_t target;
+            if(!deleted_indices.empty()){
+                target = *deleted_indices.begin();
+                deleted_indices.erase(target);
+            }else{
+                target = arrays.next_index++;
+            }
+            const auto id = next_id++;
+            arrays.instances[target] = instance;
+            arrays.data[target] = d;
+            arrays.ids[target] = id;
+            instance_map.insert({id, target});
+            arrays.mark_dirty(target, 3);
+            return id;
+        }
+
+        void set_transform(uint64_t id, float value){
+            arrays.instances[instance_map.at(id)].transform[3] = value;
+            arrays.mark_dirty(instance_map.at(id), 1);
+        }
+
+        void remove(uint64_t id){
+            const auto target = instance_map.at(id);
+            arrays.instances[target] = {};
+            if(target == arrays.next_index - 1){
+                arrays.next_index--;
+                while(deleted_indices.contains(arrays.next_index - 1))
+                    deleted_indices.erase(--arrays.next_index);
+            }else{
+                deleted_indices.insert(target);
+            }
+            instance_map.erase(id);
+        }
+
+        size_t build(){
+            defragment();
+            return arrays.upload();
+        }
+
+        [[nodiscard]] uint32_t count() const{
+            return arrays.next_index;
+        }
+
+    private:
+        instance_arrays arrays;
+        std::map<uint64_t, uint32_t> instance_map;
+        std::set<uint32_t> deleted_indices;
+        uint64_t next_id = 0;
+
+        void defragment(){
+            while(!deleted_indices.empty()){
+                const auto src = arrays.next_index - 1;
+                const auto dst = *deleted_indices.begin();
+                const auto id = arrays.ids[src];
+                arrays.ids[dst] = id;
+                arrays.instances[dst] = arrays.instances[src];
+                arrays.data[dst] = arrays.data[src];
+                arrays.instances[src] = {};
+                instance_map.at(id) = dst;
+                arrays.mark_dirty(dst, 3);
+                deleted_indices.erase(dst);
+                arrays.next_index--;
+                while(deleted_indices.contains(arrays.next_index - 1))
+                    deleted_indices.erase(--arrays.next_index);
+            }
+        }
+    };
+
+    class slot_map_bookkeeping{
+    public:
+        explicit slot_map_bookkeeping(uint32_t max_instances) : arrays(max_instances){
+            instance_map.reserve(max_instances);
+        }
+
+        uint64_t add(const as_instance& instance, const instance_data& d){
+            const uint32_t target = arrays.next_index++;
+            const auto id = instance_map.insert(target);
+            arrays.instances[target] = instance;
+            arrays.data[target] = d;
+            arrays.ids[target] = id;
+            arrays.mark_dirty(target, 3);
+            return id;
+        }
+
+        void set_transform(uint64_t id, float value){
+            if(const auto* target = instance_map.get(id)){
+                arrays.mark_dirty(*target, 1);
+                arrays.instances[*target].transform[3] = value;
+            }
+        }
+
+        void remove(uint64_t id){
+            const auto* target = instance_map.get(id);
+            if(!target)
+                return;
+            const uint32_t last = --arrays.next_index;
+            if(*target != last){
+                const auto moved = arrays.ids[last];
+                arrays.ids[*target] = moved;
+                arrays.instances[*target] = arrays.instances[last];
+                arrays.data[*target] = arrays.data[last];
+                arrays.mark_dirty(*target, 3);
+                *instance_map.get(moved) = *target;
+            }
+            arrays.instances[last] = {};
+            instance_map.erase(id);
+        }
+
+        size_t build(){
+            return arrays.upload();
+        }
+
+        [[nodiscard]] uint32_t count() const{
+            return arrays.next_index;
+        }
+
+    private:
+        instance_arrays arrays;
+        lava::rtt_extension::slot_map<uint32_t> instance_map;
+    };
+
+    struct timings{
+        double add = 0.;
+        double update = 0.;
+        double remove = 0.;
+    };
+
+    template<class F>
+    double time_ms(F&& f){
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // adds count instances, moves every one of them rounds times (in random order, one build per round) and removes
+    // them all in random order; every phase ends with a build like the renderer's next frame would
+    template<class B>
+    timings run(uint32_t count, uint32_t rounds, size_t& checksum){
+        B bookkeeping(count);
+        std::vector<uint64_t> ids(count);
+        std::mt19937 rng(42);
+        timings t;
+
+        t.add = time_ms([&] {
+            for(uint32_t i = 0; i < count; i++)
+                ids[i] = bookkeeping.add(as_instance{.custom_index_mask = i}, instance_data{.mesh = i});
+            checksum += bookkeeping.build();
+        });
+
+        std::vector<uint64_t> order = ids;
+        std::shuffle(order.begin(), order.end(), rng);
+        t.update = time_ms([&] {
+            for(uint32_t round = 0; round < rounds; round++){
+                for(auto id : order)
+                    bookkeeping.set_transform(id, float(round));
+                checksum += bookkeeping.build();
+            }
+        });
+
+        std::shuffle(order.begin(), order.end(), rng);
+        t.remove = time_ms([&] {
+            for(auto id : order)
+                bookkeeping.remove(id);
+            checksum += bookkeeping.build();
+        });
+        checksum += bookkeeping.count();
+        return t;
+    }
+}
+
+int main(int argc, char** argv){
+    const uint32_t count = argc > 1 ? uint32_t(std::strtoul(argv[1], nullptr, 10)) : 100000;
+    const uint32_t rounds = argc > 2 ? uint32_t(std::strtoul(argv[2], nullptr, 10)) : 10;
+    if(count == 0){
+        std::cerr << "usage: fb_tlas_bookkeeping_bench [instance count] [update rounds]\n";
+        return 1;
+    }
+
+    size_t checksum = 0;
+    const timings old_path = run<map_bookkeeping>(count, rounds, checksum);
+    const timings new_path = run<slot_map_bookkeeping>(count, rounds, checksum);
+
+    std::cout << count << " instances, " << rounds << " update rounds (ms, std::map + std::set -> slot_map)\n";
+    std::cout << "add:    " << old_path.add << " -> " << new_path.add << "\n";
+    std::cout << "update: " << old_path.update << " -> " << new_path.update << "\n";
+    std::cout << "remove: " << old_path.remove << " -> " << new_path.remove << "\n";
+    std::cout << "(checksum " << checksum << ")\n";
+    return 0;
+}
@@ -2,6 +2,7 @@
 
 #include "src/tlas.hpp"
 #include "src/blas.hpp"
+#include "src/scratch_allocator.hpp"
 #include "src/acceleration_structure_helpers.hpp"
 #include "src/rt_pipeline.hpp"
 #include "src/rt_helper.hpp"
\ No newline at end of file
@@ -2,34 +2,93 @@
 
 #include "blas.hpp"
 #include "tlas.hpp"
+#include "scratch_allocator.hpp"
 #include "liblava/resource/buffer.hpp"
 
 namespace lava::rtt_extension {
 
-template<class Ta = std::vector<blas*>::iterator,
-        class Tb = std::vector<tlas<int>*>::iterator>
-inline buffer::ptr build_acceleration_structures(device_p device,VkCommandBuffer cmd_buf, Ta begin_blas, Ta end_blas, Tb begin_tlas, Tb end_tlas, buffer::ptr scratch_buffer = {}, VkDeviceSize min_scratch_buffer_size = 0) {
-    for (auto it = begin_blas; it != end_blas; it++) {
-        min_scratch_buffer_size = std::max(min_scratch_buffer_size, (*it)->scratch_buffer_size());
+namespace detail {
+
+inline VkDeviceSize align_scratch(VkDeviceSize value, VkDeviceSize alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+inline bool ensure_scratch_buffer(device_p device, buffer::ptr& scratch_buffer, VkDeviceSize min_scratch_buffer_size) {
+    if(scratch_buffer and scratch_buffer->get_size() >= min_scratch_buffer_size)
+        return true;
+
+    if(scratch_buffer){
+        log()->warn("build_acceleration_structures: scratch_buffer to small relocating from {} to {} => wait_for_idle", scratch_buffer->get_size(),  min_scratch_buffer_size);
+        device->wait_for_idle();
     }
+    scratch_buffer = buffer::make();
+    if (!scratch_buffer->create(device, nullptr, min_scratch_buffer_size,
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR)) {
+        log()->error("build_acceleration_structures: scratch_buffer creation failed");
+        scratch_buffer.reset();
+        return false;
+    }
+    return true;
+}
 
-    for (auto it = begin_tlas; it != end_tlas; it++) {
-        min_scratch_buffer_size = std::max(min_scratch_buffer_size, (*it)->scratch_buffer_size());
+// Scratch space of all blas builds of one batch: every blas gets its own aligned region, so they can run concurrently.
+// The alignment is added once on top to be able to align the base address of the buffer as well.
+template<class T>
+inline VkDeviceSize batched_blas_scratch_size(T begin_blas, T end_blas, VkDeviceSize alignment) {
+    VkDeviceSize size = 0;
+    for (auto it = begin_blas; it != end_blas; it++) {
+        size += align_scratch((*it)->scratch_buffer_size(), alignment);
     }
+    return size == 0 ? 0 : size + alignment;
+}
 
-    if(!scratch_buffer or scratch_buffer->get_size() < min_scratch_buffer_size){
-        if(scratch_buffer){
-            log()->warn("build_acceleration_structures: scratch_buffer to small relocating from {} to {} => wait_for_idle", scratch_buffer->get_size(),  min_scratch_buffer_size);
-            device->wait_for_idle();
-        }
-        scratch_buffer = buffer::make();
-        if (!scratch_buffer->create(device, nullptr, min_scratch_buffer_size,
-                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR)) {
-            log()->error("build_acceleration_structures: scratch_buffer creation failed");
-            scratch_buffer.reset();
-            return nullptr;
+// Records all blas builds with a single vkCmdBuildAccelerationStructuresKHR
+template<class T>
+inline void record_batched_blas_builds(device_p device, VkCommandBuffer cmd_buf, T begin_blas, T end_blas, VkDeviceAddress scratch_buffer_address, VkDeviceSize alignment) {
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> build_infos;
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> build_ranges;
+
+    VkDeviceAddress offset = align_scratch(scratch_buffer_address, alignment);
+    for (auto it = begin_blas; it != end_blas; it++) {
+        if ((*it)->get() == VK_NULL_HANDLE) {
+            log()->error("build_acceleration_structures: invalid blas handle");
+            continue;
         }
+        const VkDeviceSize size = (*it)->scratch_buffer_size();
+        build_infos.push_back((*it)->prepare_build(offset));
+        build_ranges.push_back((*it)->get_build_ranges());
+        offset += align_scratch(size, alignment);
     }
+
+    if (build_infos.empty())
+        return;
+
+    device->call().vkCmdBuildAccelerationStructuresKHR(cmd_buf, uint32_t(build_infos.size()), build_infos.data(), build_ranges.data());
+}
+
+template<class Ta, class Tb>
+inline VkDeviceSize scratch_alignment(Ta begin_blas, Ta end_blas, Tb begin_tlas, Tb end_tlas) {
+    if (begin_blas != end_blas)
+        return std::max<VkDeviceSize>(1, (*begin_blas)->get_properties().minAccelerationStructureScratchOffsetAlignment);
+    if (begin_tlas != end_tlas)
+        return std::max<VkDeviceSize>(1, (*begin_tlas)->get_properties().minAccelerationStructureScratchOffsetAlignment);
+    return 1;
+}
+
+template<class Ta, class Tb, class F>
+inline buffer::ptr build_acceleration_structures(device_p device, VkCommandBuffer cmd_buf, Ta begin_blas, Ta end_blas, Tb begin_tlas, Tb end_tlas,
+                                                 VkDeviceSize min_scratch_buffer_size, F&& get_scratch_buffer) {
+    const VkDeviceSize alignment = scratch_alignment(begin_blas, end_blas, begin_tlas, end_tlas);
+
+    min_scratch_buffer_size = std::max(min_scratch_buffer_size, batched_blas_scratch_size(begin_blas, end_blas, alignment));
+    for (auto it = begin_tlas; it != end_tlas; it++) {
+        min_scratch_buffer_size = std::max(min_scratch_buffer_size, (*it)->scratch_buffer_size() + alignment);
+    }
+
+    buffer::ptr scratch_buffer = get_scratch_buffer(min_scratch_buffer_size);
+    if (!scratch_buffer)
+        return nullptr;
+
     auto scratch_buffer_address = scratch_buffer->get_address();
 
     const VkMemoryBarrier barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
@@ -38,54 +97,63 @@ inline buffer::ptr build_acceleration_structures(device_p device,VkCommandBuffer
     const VkPipelineStageFlags src = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
     const VkPipelineStageFlags dst = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
 
-    for (auto it = begin_blas; it != end_blas; it++) {
-        (*it)->build(cmd_buf, scratch_buffer_address);
+    if (begin_blas != end_blas) {
+        record_batched_blas_builds(device, cmd_buf, begin_blas, end_blas, scratch_buffer_address, alignment);
         device->call().vkCmdPipelineBarrier(cmd_buf, src, dst, 0, 1, &barrier, 0, nullptr, 0, nullptr);
     }
 
     for (auto it = begin_tlas; it != end_tlas; it++) {
-        (*it)->build(cmd_buf, scratch_buffer_address);
+        (*it)->build(cmd_buf, align_scratch(scratch_buffer_address, alignment));
         device->call().vkCmdPipelineBarrier(cmd_buf, src, dst, 0, 1, &barrier, 0, nullptr, 0, nullptr);
     }
     return scratch_buffer;
 }
 
-template<class T = std::vector<blas*>::iterator>
-inline buffer::ptr build_acceleration_structures(device_p device, VkCommandBuffer cmd_buf, T begin_, T end_, buffer::ptr scratch_buffer = {}, VkDeviceSize min_scratch_buffer_size = 0) {
-    for (auto it = begin_; it != end_; it++) {
-        auto temp = (*it)->scratch_buffer_size();
-        min_scratch_buffer_size = std::max(min_scratch_buffer_size, temp);
-    }
+}
 
-    if(!scratch_buffer or scratch_buffer->get_size() < min_scratch_buffer_size){
-        if(scratch_buffer){
-            log()->warn("build_acceleration_structures: scratch_buffer to small relocating from {} to {} => wait_for_idle", scratch_buffer->get_size(),  min_scratch_buffer_size);
-            device->wait_for_idle();
-        }
-        scratch_buffer = buffer::make();
-        if (!scratch_buffer->create(device, nullptr, min_scratch_buffer_size,
-                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR)) {
-            log()->error("build_acceleration_structures: scratch_buffer creation failed");
-            scratch_buffer.reset();
-            return nullptr;
-        }
+// Scratch size needed to build the given acceleration structures with build_acceleration_structures,
+// e.g. to pre-size a scratch_allocator with the largest build
+template<class Ta = std::vector<blas*>::iterator,
+        class Tb = std::vector<tlas<int>*>::iterator>
+inline VkDeviceSize required_scratch_size(Ta begin_blas, Ta end_blas, Tb begin_tlas = {}, Tb end_tlas = {}) {
+    const VkDeviceSize alignment = detail::scratch_alignment(begin_blas, end_blas, begin_tlas, end_tlas);
+    VkDeviceSize size = detail::batched_blas_scratch_size(begin_blas, end_blas, alignment);
+    for (auto it = begin_tlas; it != end_tlas; it++) {
+        size = std::max(size, (*it)->scratch_buffer_size() + alignment);
     }
+    return size;
+}
 
-    auto scratch_buffer_address = scratch_buffer->get_address();
-
-    const VkMemoryBarrier barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-            .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
-            .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR };
-    const VkPipelineStageFlags src = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
-    const VkPipelineStageFlags dst = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
-
-    for (auto it = begin_; it != end_; it++) {
-        (*it)->build(cmd_buf, scratch_buffer_address);
-        device->call().vkCmdPipelineBarrier(cmd_buf, src, dst, 0, 1, &barrier, 0, nullptr, 0, nullptr);
-    }
-    return scratch_buffer;
+// Builds all blas in one batch (sub-allocating the scratch buffer per blas), then the tlas one after another.
+// The tlas reuse the scratch memory of the blas after the barrier.
+// A too small scratch_buffer is replaced after waiting for the device to idle, prefer the scratch_allocator overload per frame.
+template<class Ta = std::vector<blas*>::iterator,
+        class Tb = std::vector<tlas<int>*>::iterator>
+inline buffer::ptr build_acceleration_structures(device_p device,VkCommandBuffer cmd_buf, Ta begin_blas, Ta end_blas, Tb begin_tlas, Tb end_tlas, buffer::ptr scratch_buffer = {}, VkDeviceSize min_scratch_buffer_size = 0) {
+    return detail::build_acceleration_structures(device, cmd_buf, begin_blas, end_blas, begin_tlas, end_tlas, min_scratch_buffer_size,
+                                                 [&](VkDeviceSize size) {
+                                                     return detail::ensure_scratch_buffer(device, scratch_buffer, size) ? scratch_buffer : nullptr;
+                                                 });
 }
 
+// Same as above, but growing the scratch buffer never stalls: the old buffer is released once the frames using it are done
+template<class Ta = std::vector<blas*>::iterator,
+        class Tb = std::vector<tlas<int>*>::iterator>
+inline buffer::ptr build_acceleration_structures(device_p device,VkCommandBuffer cmd_buf, Ta begin_blas, Ta end_blas, Tb begin_tlas, Tb end_tlas, scratch_allocator& scratch) {
+    return detail::build_acceleration_structures(device, cmd_buf, begin_blas, end_blas, begin_tlas, end_tlas, 0,
+                                                 [&](VkDeviceSize size) { return scratch.request(size); });
+}
 
+template<class T = std::vector<blas*>::iterator>
+inline buffer::ptr build_acceleration_structures(device_p device, VkCommandBuffer cmd_buf, T begin_, T end_, buffer::ptr scratch_buffer = {}, VkDeviceSize min_scratch_buffer_size = 0) {
+    if (begin_ == end_)
+        return scratch_buffer;
+
+    using tlas_iterator = std::vector<tlas<int>*>::iterator;
+    return detail::build_acceleration_structures(device, cmd_buf, begin_, end_, tlas_iterator{}, tlas_iterator{}, min_scratch_buffer_size,
+                                                 [&](VkDeviceSize size) {
+                                                     return detail::ensure_scratch_buffer(device, scratch_buffer, size) ? scratch_buffer : nullptr;
+                                                 });
+}
 
-}
\ No newline at end of file
+}
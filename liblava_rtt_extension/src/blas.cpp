@@ -79,15 +79,7 @@ void lava::rtt_extension::blas::add_geometry(const VkAccelerationStructureGeomet
     ranges.push_back(range);
 }
 
-bool lava::rtt_extension::blas::build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer) {
-    if (handle == VK_NULL_HANDLE) {
-        log()->error("blas build: invalid handle");
-        return false;
-    }
-//    if (built && !(build_info.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
-//        log()->error("blas build: trying update without VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR set");
-//        return false;
-//    }
+const VkAccelerationStructureBuildGeometryInfoKHR& lava::rtt_extension::blas::prepare_build(VkDeviceAddress scratch_buffer) {
     bool update = built && (build_info.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
     build_info.mode = update ?
             VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
@@ -96,11 +88,23 @@ bool lava::rtt_extension::blas::build(VkCommandBuffer cmd_buf, VkDeviceAddress s
     build_info.geometryCount = uint32_t(geometries.size());
     build_info.pGeometries = geometries.data();
     build_info.scratchData.deviceAddress = scratch_buffer;
+    built = true;
+    return build_info;
+}
 
+bool lava::rtt_extension::blas::build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer) {
+    if (handle == VK_NULL_HANDLE) {
+        log()->error("blas build: invalid handle");
+        return false;
+    }
+//    if (built && !(build_info.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
+//        log()->error("blas build: trying update without VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR set");
+//        return false;
+//    }
+    const VkAccelerationStructureBuildGeometryInfoKHR& info = prepare_build(scratch_buffer);
     const VkAccelerationStructureBuildRangeInfoKHR* build_ranges = ranges.data();
 
-    device->call().vkCmdBuildAccelerationStructuresKHR(cmd_buf, 1, &build_info, &build_ranges);
-    built = true;
+    device->call().vkCmdBuildAccelerationStructuresKHR(cmd_buf, 1, &info, &build_ranges);
 
 //    if (build_info.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) {
 //        const VkMemoryBarrier barrier = {
@@ -47,6 +47,14 @@ public:
 
     bool build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer);
 
+    // fills the build info for a build (or update) into scratch_buffer without recording it,
+    // so that several blas can be built with one vkCmdBuildAccelerationStructuresKHR (see build_acceleration_structures)
+    const VkAccelerationStructureBuildGeometryInfoKHR& prepare_build(VkDeviceAddress scratch_buffer);
+
+    [[nodiscard]] inline const VkAccelerationStructureBuildRangeInfoKHR* get_build_ranges() const {
+        return ranges.data();
+    }
+
     void destroy();
 
     inline ~blas(){
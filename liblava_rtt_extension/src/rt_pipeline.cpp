@@ -273,5 +273,15 @@ void raytracing_pipeline::bind_and_trace(VkCommandBuffer cmd_buf, uint32_t x, ui
             x, y, z);
 }
 
+void raytracing_pipeline::bind_and_trace_indirect(VkCommandBuffer cmd_buf, VkDeviceAddress indirect_address, uint32_t ray_gen_index) {
+    bind(cmd_buf);
+
+    const VkStridedDeviceAddressRegionKHR ray_gen = get_gen_region(ray_gen_index);
+    device->call().vkCmdTraceRaysIndirectKHR(
+            cmd_buf,
+            &ray_gen, &get_miss_region(), &get_hit_region(), &get_callable_region(),
+            indirect_address);
+}
+
 
 }
\ No newline at end of file
@@ -77,6 +77,9 @@ public:
 
     void bind_and_trace(VkCommandBuffer cmd_buf, uint32_t x, uint32_t y, uint32_t z = 1, uint32_t ray_gen_index = 0);
 
+    // launch size is read from a VkTraceRaysIndirectCommandKHR at indirect_address (needs rayTracingPipelineTraceRaysIndirect)
+    void bind_and_trace_indirect(VkCommandBuffer cmd_buf, VkDeviceAddress indirect_address, uint32_t ray_gen_index = 0);
+
     inline bool add_ray_gen_shader(cdata const &data, size_t record_size = 0){
         return add_shader_stage(data, gen_shader_stages, VK_SHADER_STAGE_RAYGEN_BIT_KHR, record_size);
     }
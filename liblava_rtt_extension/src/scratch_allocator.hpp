@@ -0,0 +1,96 @@
+#pragma once
+
+#include <liblava/base/device.hpp>
+#include <liblava/resource/buffer.hpp>
+#include <memory>
+#include <vector>
+
+namespace lava::rtt_extension{
+
+// Scratch buffer for acceleration structure builds that grows without idling the device.
+// A replaced buffer may still be in use by frames in flight, so it is kept alive until its frame slot
+// is recorded again (the renderer waited for the fence of that slot by then).
+class scratch_allocator {
+public:
+    using ptr = std::shared_ptr<scratch_allocator>;
+
+    // frame_count: frames in flight; initial_size should cover the largest build to never grow at runtime
+    inline bool create(device_p _device, uint32_t frame_count, VkDeviceSize initial_size = 0){
+        destroy();
+        device = _device;
+        retired.resize(std::max(frame_count, 1u));
+        current_frame = 0;
+        return initial_size == 0 || grow(initial_size);
+    }
+
+    // releases the buffers retired the last time this frame slot was recorded
+    inline void begin_frame(uint32_t frame){
+        current_frame = frame % uint32_t(retired.size());
+        for(auto& b : retired[current_frame])
+            b->destroy();
+        retired[current_frame].clear();
+    }
+
+    // returns a buffer of at least size bytes; nullptr if the allocation failed
+    inline buffer::ptr request(VkDeviceSize size){
+        if(scratch_buffer && scratch_buffer->get_size() >= size)
+            return scratch_buffer;
+        return grow(size) ? scratch_buffer : nullptr;
+    }
+
+    [[nodiscard]] inline buffer::ptr get() const {
+        return scratch_buffer;
+    }
+
+    [[nodiscard]] inline VkDeviceSize get_size() const {
+        return scratch_buffer ? scratch_buffer->get_size() : 0;
+    }
+
+    inline void destroy(){
+        for(auto& list : retired){
+            for(auto& b : list)
+                b->destroy();
+            list.clear();
+        }
+        if(scratch_buffer){
+            scratch_buffer->destroy();
+            scratch_buffer.reset();
+        }
+    }
+
+    inline ~scratch_allocator(){
+        destroy();
+    }
+
+    inline static ptr make(){
+        return std::make_shared<scratch_allocator>();
+    };
+
+private:
+    device_p device = nullptr;
+    buffer::ptr scratch_buffer;
+    std::vector<std::vector<buffer::ptr>> retired;
+    uint32_t current_frame = 0;
+
+    inline bool grow(VkDeviceSize size){
+        // geometric growth, so a slowly growing surface only reallocates a few times
+        const VkDeviceSize new_size = std::max(size, get_size() + get_size() / 2);
+
+        auto new_buffer = buffer::make();
+        if (!new_buffer->create(device, nullptr, new_size,
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR)) {
+            log()->error("scratch_allocator: scratch_buffer creation failed ({} bytes)", new_size);
+            return false;
+        }
+        if(scratch_buffer){
+            log()->debug("scratch_allocator: growing from {} to {}", scratch_buffer->get_size(), new_size);
+            if(retired.empty())
+                retired.resize(1);
+            retired[current_frame].push_back(scratch_buffer);
+        }
+        scratch_buffer = new_buffer;
+        return true;
+    }
+};
+
+}
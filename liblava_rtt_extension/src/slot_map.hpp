@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace lava::rtt_extension{
+
+// Maps generational handles to a value with O(1) insert, lookup and erase.
+// A handle packs the slot index (low 32 bits) and the generation of the slot (high 32 bits);
+// erasing bumps the generation, so stale handles are detected instead of aliasing a reused slot.
+// Generations start at 1, so the handle 0 is never valid.
+template <class V>
+class slot_map {
+public:
+    using handle = uint64_t;
+
+    inline void reserve(uint32_t capacity){
+        slots.reserve(capacity);
+        free_slots.reserve(capacity);
+    }
+
+    inline handle insert(const V& value){
+        uint32_t index;
+        if(!free_slots.empty()){
+            index = free_slots.back();
+            free_slots.pop_back();
+        }else{
+            index = static_cast<uint32_t>(slots.size());
+            slots.push_back({});
+        }
+        slot& s = slots[index];
+        s.value = value;
+        s.live = true;
+        size++;
+        return make_handle(index, s.generation);
+    }
+
+    [[nodiscard]] inline bool contains(handle h) const {
+        const uint32_t index = index_of(h);
+        return index < slots.size() && slots[index].live && slots[index].generation == generation_of(h);
+    }
+
+    // nullptr for stale or invalid handles
+    [[nodiscard]] inline V* get(handle h){
+        return contains(h) ? &slots[index_of(h)].value : nullptr;
+    }
+
+    [[nodiscard]] inline const V* get(handle h) const {
+        return contains(h) ? &slots[index_of(h)].value : nullptr;
+    }
+
+    inline bool erase(handle h){
+        if(!contains(h))
+            return false;
+        const uint32_t index = index_of(h);
+        slot& s = slots[index];
+        s.live = false;
+        // skip 0 on wrap around, it marks the invalid handle
+        if(++s.generation == 0)
+            s.generation = 1;
+        free_slots.push_back(index);
+        size--;
+        return true;
+    }
+
+    // invalidates all handles, the slots are kept for reuse
+    inline void clear(){
+        free_slots.clear();
+        for(uint32_t i = static_cast<uint32_t>(slots.size()); i-- > 0;){
+            slot& s = slots[i];
+            if(s.live){
+                s.live = false;
+                if(++s.generation == 0)
+                    s.generation = 1;
+            }
+            free_slots.push_back(i);
+        }
+        size = 0;
+    }
+
+    [[nodiscard]] inline uint32_t get_size() const {
+        return size;
+    }
+
+    [[nodiscard]] inline bool empty() const {
+        return size == 0;
+    }
+
+private:
+    struct slot {
+        V value{};
+        uint32_t generation = 1;
+        bool live = false;
+    };
+
+    std::vector<slot> slots;
+    // slots are reused in lifo order, the most recently freed one is still in cache
+    std::vector<uint32_t> free_slots;
+    uint32_t size = 0;
+
+    static inline handle make_handle(uint32_t index, uint32_t generation){
+        return (static_cast<uint64_t>(generation) << 32) | index;
+    }
+
+    static inline uint32_t index_of(handle h){
+        return static_cast<uint32_t>(h);
+    }
+
+    static inline uint32_t generation_of(handle h){
+        return static_cast<uint32_t>(h >> 32);
+    }
+};
+
+}
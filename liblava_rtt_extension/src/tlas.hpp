@@ -7,7 +7,10 @@
 #include <memory>
 #include <vector>
 #include <optional>
+#include <algorithm>
+#include <span>
 #include "blas.hpp"
+#include "slot_map.hpp"
 
 namespace lava::rtt_extension{
 
@@ -16,7 +19,13 @@ class tlas {
 public:
     using ptr = std::shared_ptr<tlas<T>>;
 
-    bool create(device_p device, uint32_t max_instances, VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    // frame_count: frames in flight, each gets its own slice of the staging buffers
+    bool create(device_p device, uint32_t max_instances, uint32_t frame_count, VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+
+    // selects the staging slice of this frame slot; the renderer waited for the fence of the slot by then
+    inline void begin_frame(uint32_t frame){
+        current_frame = frame % std::max(frame_count, 1u);
+    }
 
     bool build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buffer);
 
@@ -59,7 +68,7 @@ public:
 
     std::pair<bool,uint64_t> add_instance(const VkAccelerationStructureInstanceKHR& as_instance, const T& instance_data);
 
-    std::pair<bool,uint64_t> add_instance(const blas &bottom_as, const glm::mat4x3 &transform = glm::identity<glm::mat4x3>(), const T &instance_d = {}, uint32_t shader_offset = 0, uint32_t custom_index = 0);
+    std::pair<bool,uint64_t> add_instance(const blas &bottom_as, const glm::mat4x3 &transform = glm::identity<glm::mat4x3>(), const T &instance_d = {}, uint32_t shader_offset = 0, uint32_t custom_index = 0, uint8_t mask = 0xff);
 
     void set_instance_data(uint64_t id, const T& instance_data);
 
@@ -79,6 +88,8 @@ public:
 
     void remove_instance(uint64_t id);
 
+    void remove_instances(std::span<const uint64_t> ids);
+
 private:
     device_p device = nullptr;
 
@@ -111,32 +122,55 @@ private:
     std::optional<VkAccelerationStructureBuildRangeInfoKHR> instances_ranges;
 
     uint32_t max_instances = 0;
+    uint32_t frame_count = 1;
+    uint32_t current_frame = 0;
 
+    // the staging buffers hold frame_count slices of max_instances: only dirty instances are copied, so a slice
+    // the copy of an earlier frame in flight still reads from must not be written
     std::vector<VkAccelerationStructureInstanceKHR> as_instance_cpu;
+    buffer as_instance_staging_buffer;
     buffer as_instance_buffer;
 
     std::vector<T> instance_data_cpu;
     buffer instance_data_staging_buffer;
     buffer instance_data_buffer;
 
+    // id of the instance at each index, to patch the slot of the instance moved by a removal
     std::vector<uint64_t> instance_ids;
 
-    std::map<uint64_t,uint32_t> instance_map;
+    // id -> index into the instance arrays; the instances are kept dense by swapping the last one into removed indices
+    slot_map<uint32_t> instance_map;
 
     uint32_t next_instance_index = 0;
-    uint64_t next_id = 0;
-
-    uint32_t highest_accessed_instance_index = 0;
-    uint32_t lowes_accessed_instance_index = 0;
 
-    std::set<uint32_t> deleted_indices;
+    // per instance dirty bits; only the dirty instances are copied to the gpu (coalesced into runs)
+    enum dirty_bit : uint8_t {
+        instance_dirty = 1, // VkAccelerationStructureInstanceKHR
+        data_dirty = 2 // T
+    };
+    std::vector<uint8_t> dirty;
+    std::vector<uint32_t> dirty_indices;
+
+    // instances were added, removed or moved -> full build
+    bool rebuild_required = true;
+    // only transforms or the contents of referenced blas changed -> update (refit) if allowed
+    bool update_required = false;
+    uint32_t built_instance_count = 0;
+    uint32_t updates_since_build = 0;
+    // refits degrade the trace performance over time, so every n-th update is a full build again
+    static constexpr uint32_t MAX_UPDATES_BETWEEN_BUILDS = 64;
 
     bool created = false;
     bool built = false;
 
-    void defragment();
+    void remove_at(uint32_t target);
+
+    void mark_dirty(uint32_t index, uint8_t bits);
+
+    void upload_dirty_instances(VkCommandBuffer cmd_buf);
 
-    std::pair<VkAccelerationStructureInstanceKHR*, T*> at(uint64_t id);
+    // marks the instance dirty with bits; {nullptr, nullptr} for invalid ids
+    std::pair<VkAccelerationStructureInstanceKHR*, T*> at(uint64_t id, uint8_t bits);
 
 public:
     inline static ptr make(){
@@ -145,36 +179,91 @@ public:
 };
 
 template<class T>
-inline void tlas<T>::defragment() {
-    if(deleted_indices.empty())
-        return;
-
-    if(next_instance_index-1 > highest_accessed_instance_index)
-        highest_accessed_instance_index = next_instance_index-1;
-    if(*deleted_indices.rbegin() > highest_accessed_instance_index)
-        highest_accessed_instance_index = *deleted_indices.rbegin();
-    if(*deleted_indices.begin() < lowes_accessed_instance_index)
-        lowes_accessed_instance_index = *deleted_indices.begin();
-
-    while(!deleted_indices.empty()){
-        auto src = next_instance_index-1;
-        auto dst = *deleted_indices.begin();
-        auto id = instance_ids[src];
-
-        instance_ids[dst] = id;
-        as_instance_cpu[dst] = as_instance_cpu[src];
-        instance_data_cpu[dst] = instance_data_cpu[src];
-        as_instance_cpu[src] = {};
+inline void tlas<T>::remove_at(uint32_t target) {
+    const uint32_t last = --next_instance_index;
+    if(target != last){
+        const auto id = instance_ids[last];
+        instance_ids[target] = id;
+        as_instance_cpu[target] = as_instance_cpu[last];
+        instance_data_cpu[target] = instance_data_cpu[last];
+        *instance_map.get(id) = target;
+        mark_dirty(target, instance_dirty | data_dirty);
+    }
+    as_instance_cpu[last] = {};
+    rebuild_required = true;
+}
 
-        instance_map.at(id) = dst;
+template<class T>
+inline void tlas<T>::mark_dirty(uint32_t index, uint8_t bits) {
+    if(bits == 0)
+        return;
+    if(dirty[index] == 0)
+        dirty_indices.push_back(index);
+    dirty[index] |= bits;
+}
 
-        deleted_indices.erase(dst);
+template<class T>
+inline void tlas<T>::upload_dirty_instances(VkCommandBuffer cmd_buf) {
+    std::sort(dirty_indices.begin(), dirty_indices.end());
+
+    const size_t slice = size_t(current_frame) * max_instances;
+    auto* as_instance_staging_p = static_cast<VkAccelerationStructureInstanceKHR *>(as_instance_staging_buffer.get_mapped_data()) + slice;
+    auto* instance_data_staging_p = static_cast<T *>(instance_data_staging_buffer.get_mapped_data()) + slice;
+
+    std::vector<VkBufferCopy> instance_regions;
+    std::vector<VkBufferCopy> data_regions;
+    auto add_to_run = [slice](std::vector<VkBufferCopy>& regions, uint32_t index, VkDeviceSize element_size){
+        const VkDeviceSize offset = index * element_size;
+        if(!regions.empty() && regions.back().dstOffset + regions.back().size == offset){
+            regions.back().size += element_size;
+        }else{
+            regions.push_back({.srcOffset = slice * element_size + offset, .dstOffset = offset, .size = element_size});
+        }
+    };
 
-        next_instance_index--;
-        while(deleted_indices.contains(next_instance_index-1)){
-            deleted_indices.erase(--next_instance_index);
+    for(auto index : dirty_indices){
+        // instances past the live count are not part of the build any more
+        if(index < next_instance_index){
+            if(dirty[index] & instance_dirty){
+                as_instance_staging_p[index] = as_instance_cpu[index];
+                add_to_run(instance_regions, index, sizeof(VkAccelerationStructureInstanceKHR));
+            }
+            if(dirty[index] & data_dirty){
+                instance_data_staging_p[index] = instance_data_cpu[index];
+                add_to_run(data_regions, index, sizeof(T));
+            }
         }
+        dirty[index] = 0;
     }
+    dirty_indices.clear();
+
+    if(instance_regions.empty() && data_regions.empty())
+        return;
+
+    // the last build and trace may still read the buffers
+    const VkMemoryBarrier before_copy = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT };
+    device->call().vkCmdPipelineBarrier(cmd_buf,
+                                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &before_copy, 0, nullptr, 0, nullptr);
+
+    if(!instance_regions.empty())
+        device->call().vkCmdCopyBuffer(cmd_buf, as_instance_staging_buffer.get(), as_instance_buffer.get(),
+                                       uint32_t(instance_regions.size()), instance_regions.data());
+    if(!data_regions.empty())
+        device->call().vkCmdCopyBuffer(cmd_buf, instance_data_staging_buffer.get(), instance_data_buffer.get(),
+                                       uint32_t(data_regions.size()), data_regions.data());
+
+    const VkMemoryBarrier after_copy = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR };
+    device->call().vkCmdPipelineBarrier(cmd_buf,
+                                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                        0, 1, &after_copy, 0, nullptr, 0, nullptr);
 }
 
 template<class T>
@@ -183,28 +272,18 @@ inline std::pair<bool,uint64_t> tlas<T>::add_instance(const VkAccelerationStruct
         log()->error("tlas at: call not allowed before creation");
         return {false, 0};
     }
-    uint32_t target = 0;
-
-    if(!deleted_indices.empty()){
-        target = *deleted_indices.begin();
-        deleted_indices.erase(target);
-    }else if(next_instance_index >= max_instances){
+    if(next_instance_index >= max_instances){
         return {false, 0};
-    }else{
-        target = next_instance_index++;
     }
-    auto id = next_id++;
+    const uint32_t target = next_instance_index++;
+    const auto id = instance_map.insert(target);
 
     as_instance_cpu[target] = as_instance;
     instance_data_cpu[target] = data;
     instance_ids[target] = id;
 
-    instance_map.insert({id,target});
-
-    if(target > highest_accessed_instance_index)
-        highest_accessed_instance_index = target;
-    if(target < lowes_accessed_instance_index)
-        lowes_accessed_instance_index = target;
+    mark_dirty(target, instance_dirty | data_dirty);
+    rebuild_required = true;
 
     return {true,id};
 }
@@ -215,13 +294,14 @@ inline void tlas<T>::clear_all_instances() {
         log()->error("tlas clear_all_instances: call not allowed before creation");
     }
     next_instance_index = 0;
-    deleted_indices.clear();
     instance_map.clear();
 
     std::fill(as_instance_cpu.begin(), as_instance_cpu.end(),VkAccelerationStructureInstanceKHR{});
-    if(next_instance_index - 1 > highest_accessed_instance_index)
-        highest_accessed_instance_index = next_instance_index - 1;
-    lowes_accessed_instance_index = 0;
+    // nothing is live any more, so nothing has to be uploaded
+    for(auto index : dirty_indices)
+        dirty[index] = 0;
+    dirty_indices.clear();
+    rebuild_required = true;
 }
 
 template<class T>
@@ -229,48 +309,54 @@ inline void tlas<T>::remove_instance(uint64_t id) {
     if(!created){
         log()->error("tlas at: call not allowed before creation");
     }
-    auto target = instance_map.at(id);
-
-    as_instance_cpu[target] = {};
+    const auto* target = instance_map.get(id);
+    if(!target){
+        log()->error("tlas remove_instance: invalid instance id");
+        return;
+    }
+    remove_at(*target);
+    instance_map.erase(id);
+}
 
-    if(target == next_instance_index - 1){
-        if(target > highest_accessed_instance_index)
-            highest_accessed_instance_index = target;
-        next_instance_index--;
-        while(deleted_indices.contains(next_instance_index-1)){
-            deleted_indices.erase(--next_instance_index);
+template<class T>
+inline void tlas<T>::remove_instances(std::span<const uint64_t> ids) {
+    if(!created){
+        log()->error("tlas remove_instances: call not allowed before creation");
+    }
+    for(auto id : ids){
+        const auto* target = instance_map.get(id);
+        if(!target){
+            log()->error("tlas remove_instances: invalid instance id");
+            continue;
         }
-        if(next_instance_index < lowes_accessed_instance_index)
-            lowes_accessed_instance_index = next_instance_index;
-    }else{
-        deleted_indices.insert(target);
+        remove_at(*target);
+        instance_map.erase(id);
     }
-
-    instance_map.erase(id);
 }
 
 template<class T>
-inline std::pair<VkAccelerationStructureInstanceKHR*, T*> tlas<T>::at(uint64_t id) {
+inline std::pair<VkAccelerationStructureInstanceKHR*, T*> tlas<T>::at(uint64_t id, uint8_t bits) {
     if(!created){
         log()->error("tlas at: call not allowed before creation");
     }
-    auto target = instance_map.at(id);
-    if(target > highest_accessed_instance_index)
-        highest_accessed_instance_index = target;
-    if(target < lowes_accessed_instance_index)
-        lowes_accessed_instance_index = target;
-    return {&as_instance_cpu[target], &instance_data_cpu[target]};
+    const auto* target = instance_map.get(id);
+    if(!target){
+        log()->error("tlas at: invalid instance id");
+        return {nullptr, nullptr};
+    }
+    mark_dirty(*target, bits);
+    return {&as_instance_cpu[*target], &instance_data_cpu[*target]};
 }
 
 template<class T>
 std::pair<bool, uint64_t>
-tlas<T>::add_instance(const blas &bottom_as, const glm::mat4x3 &transform, const T &instance_d, uint32_t shader_offset, uint32_t custom_index) {
+tlas<T>::add_instance(const blas &bottom_as, const glm::mat4x3 &transform, const T &instance_d, uint32_t shader_offset, uint32_t custom_index, uint8_t mask) {
     const glm::mat3x4 transposed = glm::transpose(transform);
     const VkTransformMatrixKHR& transform_ref = *reinterpret_cast<const VkTransformMatrixKHR*>(glm::value_ptr(transposed));
     return add_instance({
                          .transform = transform_ref,
                          .instanceCustomIndex = custom_index,
-                         .mask = static_cast<uint8_t>(~0u),
+                         .mask = mask,
                          .instanceShaderBindingTableRecordOffset = shader_offset,
                          .flags = 0u,
                          .accelerationStructureReference = bottom_as.get_address()},instance_d);
@@ -278,23 +364,29 @@ tlas<T>::add_instance(const blas &bottom_as, const glm::mat4x3 &transform, const
 
 template<class T>
 inline void tlas<T>::set_instance_data(uint64_t id, const T &instance_d) {
-    *at(id).second = instance_d;
+    if(auto* data = at(id, data_dirty).second)
+        *data = instance_d;
 }
 
 template<class T>
 inline void tlas<T>::set_instance_transform(uint64_t id, const glm::mat4x3 &transform) {
     const glm::mat3x4 transposed = glm::transpose(transform);
     const VkTransformMatrixKHR& transform_ref = *reinterpret_cast<const VkTransformMatrixKHR*>(glm::value_ptr(transposed));
-    at(id).first->transform = transform_ref;
+    if(auto* instance = at(id, instance_dirty).first){
+        instance->transform = transform_ref;
+        update_required = true;
+    }
 }
 
 template<class T>
 inline void tlas<T>::set_change_flag(uint64_t id) {
-    at(id);
+    // the referenced blas was rebuilt, the instance itself is unchanged
+    if(at(id, 0).first)
+        update_required = true;
 }
 
 template<class T>
-inline bool tlas<T>::create(device_p _device, uint32_t _max_instances, VkBuildAccelerationStructureFlagsKHR flags) {
+inline bool tlas<T>::create(device_p _device, uint32_t _max_instances, uint32_t _frame_count, VkBuildAccelerationStructureFlagsKHR flags) {
     if(created){
         destroy();
     }
@@ -303,9 +395,12 @@ inline bool tlas<T>::create(device_p _device, uint32_t _max_instances, VkBuildAc
     created = true;
 
     max_instances = _max_instances;
+    frame_count = std::max(_frame_count, 1u);
+    current_frame = 0;
 
     instance_ids = std::vector<uint64_t>(static_cast<size_t>(max_instances), 0);
     instance_ids.shrink_to_fit();
+    instance_map.reserve(max_instances);
 
     instance_data_cpu = std::vector(static_cast<size_t>(max_instances), T{});
     instance_data_cpu.shrink_to_fit();
@@ -313,14 +408,23 @@ inline bool tlas<T>::create(device_p _device, uint32_t _max_instances, VkBuildAc
     as_instance_cpu = std::vector(static_cast<size_t>(max_instances), VkAccelerationStructureInstanceKHR{});
     as_instance_cpu.shrink_to_fit();
 
-    if (!as_instance_buffer.create_mapped(device, nullptr, sizeof(VkAccelerationStructureInstanceKHR) * max_instances,
-                                       VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-                                       VMA_MEMORY_USAGE_CPU_TO_GPU, VK_SHARING_MODE_EXCLUSIVE, {}, 16)) {
+    dirty = std::vector<uint8_t>(static_cast<size_t>(max_instances), 0);
+    dirty_indices.clear();
+
+    if (!as_instance_staging_buffer.create_mapped(device, nullptr, sizeof(VkAccelerationStructureInstanceKHR) * max_instances * frame_count,
+                                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) {
+        log()->error("tlas create: creation of instance_staging_buffer failed");
+        return false;
+    }
+
+    if (!as_instance_buffer.create(device, nullptr, sizeof(VkAccelerationStructureInstanceKHR) * max_instances,
+                                   VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+                                       VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR)) {
         log()->error("tlas create: creation of instance_buffer failed");
         return false;
     }
 
-    if (!instance_data_staging_buffer.create_mapped(device, nullptr, sizeof(T) * max_instances,
+    if (!instance_data_staging_buffer.create_mapped(device, nullptr, sizeof(T) * max_instances * frame_count,
                                                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) {
         log()->error("tlas create: creation of instance_data_staging_buffer failed");
         return false;
@@ -388,8 +492,10 @@ inline bool tlas<T>::create(device_p _device, uint32_t _max_instances, VkBuildAc
 
     check(vkCreateQueryPool(device->get(), &pool_info, memory::instance().alloc(), &query_pool));
 
-    highest_accessed_instance_index = 0;
-    lowes_accessed_instance_index = max_instances;
+    rebuild_required = true;
+    update_required = false;
+    built_instance_count = 0;
+    updates_since_build = 0;
     built = false;
 
     return true;
@@ -406,57 +512,49 @@ inline bool tlas<T>::build(VkCommandBuffer cmd_buf, VkDeviceAddress scratch_buff
 //        return false;
 //    }
 
-    defragment();
+    if(!rebuild_required && !update_required && dirty_indices.empty()){
+        return true;
+    }
+
+    upload_dirty_instances(cmd_buf);
 
-    if(highest_accessed_instance_index < lowes_accessed_instance_index){
+    // only the data of instances changed (not part of the acceleration structure)
+    if(!rebuild_required && !update_required){
         return true;
     }
 
-    auto count = highest_accessed_instance_index - lowes_accessed_instance_index + 1;
-    auto offset = lowes_accessed_instance_index;
+    const bool update = built && !rebuild_required && built_instance_count == next_instance_index &&
+                        (build_info.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR) &&
+                        updates_since_build < MAX_UPDATES_BETWEEN_BUILDS;
 
-    instances_ranges->primitiveCount = next_instance_index; //std::max(highest_accessed_instance_index+1,next_instance_index);
+    // the build only covers the live instances
+    instances_ranges->primitiveCount = next_instance_index;
 
-    bool update = built && (build_info.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
     build_info.mode = update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
     build_info.srcAccelerationStructure = update ? handle : VK_NULL_HANDLE;
     build_info.dstAccelerationStructure = handle;
     build_info.scratchData.deviceAddress = scratch_buffer;
 
     const VkAccelerationStructureBuildRangeInfoKHR* build_ranges = &*instances_ranges;
-    auto* as_instance_buffer_p = static_cast<VkAccelerationStructureInstanceKHR *>(as_instance_buffer.get_mapped_data());
-    memcpy(as_instance_buffer_p + offset,
-           as_instance_cpu.data() + offset,
-           count * sizeof(VkAccelerationStructureInstanceKHR));
-
-
     device->call().vkCmdBuildAccelerationStructuresKHR(cmd_buf, 1, &build_info, &build_ranges);
 
-//    log()->warn("count: {} offset:{}",count, offset);
-
-    VkBufferCopy staging_region{
-            .srcOffset = offset * sizeof(T),
-            .dstOffset = offset * sizeof(T),
-            .size = count * sizeof(T),
-    };
-    auto *instance_data_staging_buffer_p = static_cast<T *>(instance_data_staging_buffer.get_mapped_data());
-    memcpy(instance_data_staging_buffer_p + offset,
-           instance_data_cpu.data() + offset,
-           staging_region.size);
-    device->call().vkCmdCopyBuffer(cmd_buf,instance_data_staging_buffer.get(),instance_data_buffer.get(),1,&staging_region);
-
-    instances_ranges->primitiveCount = max_instances;
-    highest_accessed_instance_index = 0;
-    lowes_accessed_instance_index = max_instances;
+    updates_since_build = update ? updates_since_build + 1 : 0;
+    built_instance_count = next_instance_index;
+    rebuild_required = false;
+    update_required = false;
     built = true;
     return true;
 }
 
 template<class T>
 inline void tlas<T>::destroy() {
+    instance_map.clear();
+    next_instance_index = 0;
     instance_ids.clear();
     as_instance_cpu.clear();
     instance_data_cpu.clear();
+    dirty.clear();
+    dirty_indices.clear();
 
     if (handle != VK_NULL_HANDLE) {
         device->call().vkDestroyAccelerationStructureKHR(device->get(), handle, memory::instance().alloc());
@@ -469,6 +567,7 @@ inline void tlas<T>::destroy() {
         query_pool = VK_NULL_HANDLE;
     }
 
+    as_instance_staging_buffer.destroy();
     as_instance_buffer.destroy();
     instance_data_staging_buffer.destroy();
     instance_data_buffer.destroy();
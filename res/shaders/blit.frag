@@ -20,7 +20,8 @@ layout (location = 0) out vec4 out_color;
 void main() {
     ivec2 coord = ivec2(in_uv * vec2(uni.viewport.zw));
 
-    out_color = texture(texSampler, in_uv);
+    // the alpha channel of the resolved image holds the history length
+    out_color = vec4(texture(texSampler, in_uv).rgb, 1.0);
     out_color.rgb = Uncharted2ToneMapping(out_color.rgb);
 
 }
@@ -0,0 +1,33 @@
+#ifndef camera_ray_INC_HEADER_GUARD
+#define camera_ray_INC_HEADER_GUARD
+
+// Start of a camera path, shared by the megakernel tracers (path_trace.glsl) and the wavefront tracer.
+// The including shader has to declare `uni` and the `payload` before including this file.
+
+// resets the payload to a camera ray through the pixel; sample_index selects the sub pixel offset,
+// the sequence continues over frames
+void start_camera_path(ivec2 coords, int sample_index) {
+    vec4 cam_position = uni.inv_view * vec4(0.0, 0.0, 0.0, 1.0);
+
+    payload.finished = false;
+    payload.water = false;
+    payload.position = cam_position.xyz;
+    payload.color_accumulation = vec3(0);
+    payload.color_atenuation = vec3(1);
+    payload.normal = vec3(0);
+    payload.bounces = 0u;
+
+    vec2 offset = halton2d(int(uni.t.frame_index % 256u) * uni.r.max_adaptive_spp + sample_index);
+
+    vec2 pixel_center = vec2(coords) + offset;
+    vec2 uv = pixel_center / vec2(uni.trace_viewport.zw);
+
+    vec4 target = uni.inv_proj * vec4(uv * 2.0 - 1.0, 1.0, 1.0);
+    vec4 direction = uni.inv_view * vec4(normalize(target.xyz), 0.0);
+
+    payload.direction = direction.xyz;
+    payload.random.x = random(pixel_center + vec2(sin(uni.time)+uni.time,0.83213*uni.time));
+    payload.random.y = random(pixel_center.yx + vec2(sin(uni.time*0.843)+uni.time*0.4,3.232*uni.time));
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef density_field_INC_HEADER_GUARD
+#define density_field_INC_HEADER_GUARD
+
+// Direct ray marching of the density field written by calc_density.comp.
+// The including shader has to declare `uni` and the `densities` buffer before including this file.
+// Positions are in the object space of the marching cubes mesh: cube position p reads densities[p + 1].
+
+const float density_march_step = 0.5; // in voxels
+const int density_bisection_steps = 6;
+
+float density_at(ivec3 position) {
+    int side = int(uni.mesh_gen.side_voxel_count);
+    ivec3 p = clamp(position + ivec3(1), ivec3(0), ivec3(side - 1));
+    return densities[p.z * side * side + p.y * side + p.x];
+}
+
+float sample_density(vec3 position) {
+    vec3 base = floor(position);
+    vec3 f = position - base;
+    ivec3 i = ivec3(base);
+
+    float c000 = density_at(i + ivec3(0,0,0));
+    float c100 = density_at(i + ivec3(1,0,0));
+    float c010 = density_at(i + ivec3(0,1,0));
+    float c110 = density_at(i + ivec3(1,1,0));
+    float c001 = density_at(i + ivec3(0,0,1));
+    float c101 = density_at(i + ivec3(1,0,1));
+    float c011 = density_at(i + ivec3(0,1,1));
+    float c111 = density_at(i + ivec3(1,1,1));
+
+    return mix(mix(mix(c000, c100, f.x), mix(c010, c110, f.x), f.y),
+               mix(mix(c001, c101, f.x), mix(c011, c111, f.x), f.y), f.z);
+}
+
+// negative gradient -> points out of the fluid (same convention as iso_extract.comp)
+vec3 density_normal(vec3 position) {
+    const float h = 0.5;
+    return normalize(vec3(sample_density(position - vec3(h,0,0)) - sample_density(position + vec3(h,0,0)),
+                          sample_density(position - vec3(0,h,0)) - sample_density(position + vec3(0,h,0)),
+                          sample_density(position - vec3(0,0,h)) - sample_density(position + vec3(0,0,h))));
+}
+
+// Marches the ray through [box_min, box_max] and bisects the first crossing of the density threshold.
+bool march_density_field(vec3 origin, vec3 direction, vec3 box_min, vec3 box_max, float t_min, float t_max,
+                         out float t_hit, out vec3 normal) {
+    vec3 inv_direction = 1.0 / direction;
+    vec3 t0 = (box_min - origin) * inv_direction;
+    vec3 t1 = (box_max - origin) * inv_direction;
+    vec3 t_near = min(t0, t1);
+    vec3 t_far = max(t0, t1);
+    float t_enter = max(max(t_near.x, t_near.y), t_near.z);
+    float t_exit = min(min(min(t_far.x, t_far.y), t_far.z), t_max);
+
+    float dt = density_march_step / length(direction);
+    // rays starting inside the box usually start on the surface they just hit; step off it before the first sample
+    if (t_enter <= t_min) {
+        t_enter = t_min + 0.5 * dt;
+    }
+    if (t_enter >= t_exit) {
+        return false;
+    }
+
+    float iso_level = uni.mesh_gen.density_threshold;
+    bool inside = sample_density(origin + direction * t_enter) >= iso_level;
+
+    float t_last = t_enter;
+    while (t_last < t_exit) {
+        float t = min(t_last + dt, t_exit);
+        if ((sample_density(origin + direction * t) >= iso_level) != inside) {
+            float a = t_last;
+            float b = t;
+            for (int i = 0; i < density_bisection_steps; ++i) {
+                float m = 0.5 * (a + b);
+                if ((sample_density(origin + direction * m) >= iso_level) == inside) {
+                    a = m;
+                } else {
+                    b = m;
+                }
+            }
+            t_hit = 0.5 * (a + b);
+            normal = density_normal(origin + direction * t_hit);
+            return true;
+        }
+        t_last = t;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef fluid_surface_INC_HEADER_GUARD
+#define fluid_surface_INC_HEADER_GUARD
+
+// Shading of a fluid surface hit (reflection/refraction + attenuation), shared by all closest hit shaders.
+// The including shader has to declare `uni` and the `payload` before including this file.
+
+float rand(){
+    payload.random.x = random(payload.random);
+    return payload.random.x;
+}
+
+float fresnel(vec3 I, vec3 N, float eta) {
+    float kr = 1;
+    float cosi = dot(I, N); //assert <= 0
+    float sint = eta * sqrt(max(0.f, 1.0 - cosi * cosi));
+
+    // Total internal reflection
+    if (sint >= 1)
+        return kr;
+
+    float cost = sqrt(max(0., 1.0 - sint * sint));
+    cosi = abs(cosi);
+    float Rs = ((eta * cosi) - cost) / ((eta * cosi) + cost);
+    float Rp = (cosi - (eta * cost)) / (cosi + (eta * cost));
+    return (Rs * Rs + Rp * Rp) / 2;
+}
+
+// position and surface_normal in world space; the normal points out of the fluid
+void shade_fluid_surface(vec3 position, vec3 surface_normal) {
+    payload.normal = surface_normal;
+
+    bool came_from_water = payload.water;
+    float ior = came_from_water ? uni.r.ior : 1.0/uni.r.ior;
+    vec3 normal = came_from_water ? -surface_normal : surface_normal;
+
+    float d = dot(payload.direction, normal);
+    if(d > 0){// should not happen; but sometimes normals are wrong
+              payload.position = position;
+              payload.bounces += 1;
+//              payload.color_accumulation = vec3(1,0,0);
+//              payload.finished = true;
+              return;
+    }
+
+    float reflection_chance = fresnel(payload.direction, normal, ior);
+
+    if(reflection_chance > rand()){
+        payload.direction = reflect(payload.direction, normal);
+    }else{
+        payload.water = !payload.water;
+        payload.direction = refract(payload.direction, normal, ior);
+    }
+    if(came_from_water){
+        float dist = distance(payload.position, position);
+        vec3 atenuation = vec3(pow(uni.r.fluid_color.r,dist),pow(uni.r.fluid_color.g,dist),pow(uni.r.fluid_color.b,dist));
+        payload.color_atenuation *= atenuation;
+    }
+    payload.position = position;
+
+    if (payload.bounces >= uni.r.min_secondary_ray_count){
+        payload.color_atenuation *= 1.0/(uni.r.secondary_ray_survival_probability);
+        payload.finished = rand() < (1.0-uni.r.secondary_ray_survival_probability);
+    }
+
+    payload.bounces += 1;
+}
+
+#endif
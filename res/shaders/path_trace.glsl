@@ -0,0 +1,50 @@
+#ifndef path_trace_INC_HEADER_GUARD
+#define path_trace_INC_HEADER_GUARD
+
+// One camera path per call, shared by the pilot and the main ray generation shader and the ray query renderer.
+// The including shader has to declare `uni`, `topLevelAS` and the `payload` before including this file.
+// Shaders without the ray tracing pipeline define PATH_TRACE_CUSTOM_TRACE and their own trace_ray().
+
+#include "camera_ray.glsl"
+
+#ifndef PATH_TRACE_CUSTOM_TRACE
+// advances the payload by one bounce
+void trace_ray() {
+    uint culling = payload.water ? gl_RayFlagsCullFrontFacingTrianglesEXT : gl_RayFlagsCullBackFacingTrianglesEXT;
+    traceRayEXT(
+        topLevelAS,
+        gl_RayFlagsOpaqueEXT | culling,
+        uni.r.cull_mask,
+        0, // SBT hit group index
+        0, // SBT record stride
+        0, // SBT miss index
+        payload.position,
+        0.001, // min distance
+        payload.direction,
+        200.0, // max distance
+        0 // payload location
+    );
+}
+#endif
+
+// sample_index selects the sub pixel offset; the sequence continues over frames
+vec3 trace_path(ivec2 coords, int sample_index, out float primary_distance, out vec3 primary_normal, out uint primary_bounces) {
+    start_camera_path(coords, sample_index);
+    vec3 cam_position = payload.position;
+
+    primary_distance = 0.0;
+    primary_normal = vec3(0);
+    primary_bounces = 0u;
+    while(!payload.finished && payload.bounces <= uni.r.max_secondary_ray_count){
+        trace_ray();
+        if (payload.bounces <= 1u) {
+            primary_distance = distance(cam_position, payload.position);
+            primary_normal = payload.normal;
+        }
+    }
+    primary_bounces = payload.bounces;
+
+    return payload.color_accumulation; // specular reflection
+}
+
+#endif
@@ -11,12 +11,15 @@ layout (std430, set = 0, binding = 0) uniform ubo_uniforms {
 };
 
 layout (location = 0) in vec4 in_color;
+layout (location = 1) in vec2 in_uv;
 layout (location = 0) out vec4 out_color;
 
-
+// sphere impostor, lit from the camera
 void main() {
-    out_color = vec4(in_color.rgb, 1);
-    if (in_color.a < 0.5 || distance(gl_PointCoord, vec2(0.5)) > 0.5) {
+    float r2 = dot(in_uv, in_uv);
+    if (r2 > 1.0) {
         discard;
     }
+    float n_z = sqrt(1.0 - r2);
+    out_color = vec4(in_color.rgb * (0.35 + 0.65 * n_z), 1);
 }
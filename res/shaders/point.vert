@@ -9,28 +9,32 @@ layout (std430, set = 0, binding = 0) uniform ubo_uniforms {
 	uniform_data uni;
 };
 
-layout (scalar, set = 1, binding = 0) restrict readonly buffer HeadGridIn{
-	int next_insert_adress_in;
-	int head_grid_in[];
-};
-
-layout (scalar, set = 1, binding = 1) restrict readonly buffer ParticleMemoryIn{
-	Particle particle_memory_in[];
+layout (scalar, set = 0, binding = 13) restrict readonly buffer PointBuffer{
+	point_vertex points[];
 };
 
 layout (location = 0) out vec4 colorOut;
+layout (location = 1) out vec2 uvOut;
+
+const float MIN_PIXEL_RADIUS = 0.75f;
 
+// One camera facing quad per visible particle (instance), written by point_cull.comp.
+// The quad has the world space particle radius, but never gets smaller than a pixel so far particles stay visible.
 void main() {
-	gl_PointSize = 1.5f;
+	point_vertex p = points[gl_InstanceIndex];
+	vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1) * 2.0 - 1.0;
 
+	float radius = uni.mesh_gen.kernel_radius * 128 * uni.r.point_radius_scale * length(uni.fluid_model[0].xyz);
+	vec3 right = uni.inv_view[0].xyz;
+	vec3 up = uni.inv_view[1].xyz;
 
-	if(gl_VertexIndex >= next_insert_adress_in+1){
-		colorOut = vec4(0);
-		return;
-	}
+	vec4 center = uni.proj_view * vec4(p.position, 1);
+	vec4 top = uni.proj_view * vec4(p.position + up * radius, 1);
+	float pixel_radius = length((top.xy / top.w - center.xy / center.w) * 0.5 * vec2(uni.viewport.zw));
+	radius *= max(1.0, MIN_PIXEL_RADIUS / max(pixel_radius, EPS));
 
-	Particle p = particle_memory_in[gl_VertexIndex];
-	gl_Position = uni.proj_view * uni.fluid_model * vec4(p.core.pos*128, 1);
+	gl_Position = uni.proj_view * vec4(p.position + (corner.x * right + corner.y * up) * radius, 1);
 
-	colorOut = vec4(p.debug,1);
+	colorOut = unpackUnorm4x8(p.color);
+	uvOut = corner;
 }
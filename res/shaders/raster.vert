@@ -7,8 +7,9 @@
 #include "util.glsl"
 
 
+// first transform of the draw, the indirect draws add their transform index as first instance
 layout(push_constant) uniform uPushConstant {
-	mat4 model;
+	uint first_transform;
 };
 
 
@@ -20,6 +21,10 @@ layout (std430, set = 0, binding = 0) uniform ubo_uniforms {
 	uniform_data uni;
 };
 
+layout (scalar, set = 0, binding = 18) restrict readonly buffer TransformBuffer{
+	mat4 transforms[];
+};
+
 layout (location = 0) out vec3 out_color;
 
 out gl_PerVertex {
@@ -27,6 +32,7 @@ out gl_PerVertex {
 };
 
 void main() {
+	mat4 model = transforms[first_transform + gl_InstanceIndex];
 	out_color = normalize(mat3(transpose(inverse(model))) * inNormal);
 	gl_Position = uni.proj_view * model * vec4(inPos, 1.0);
 }
@@ -0,0 +1,25 @@
+#ifndef sky_INC_HEADER_GUARD
+#define sky_INC_HEADER_GUARD
+
+// Equirectangular sky box lookup, shared by the miss shader and the ray query renderer.
+// The including shader has to declare `uni` and `texSampler` (prefiltered mip chain, see environment_map.hpp).
+
+const float INV_PI = 1.0 / PI;
+const float INV_2PI = 0.5 / PI;
+
+vec2 dir_to_uv(vec3 direction)
+{
+    vec2 uv = vec2(atan(direction.z, direction.x), asin(-direction.y));
+    uv = vec2(uv.x * INV_2PI, uv.y * INV_PI) + 0.5;
+    return uv;
+}
+
+// Primary rays see the full resolution sky, every surface hit of the path moves the lookup to a more prefiltered level.
+// The fluid is a perfect mirror/refractor, so this trades a little sharpness in reflections and refractions for a lot
+// less noise from bright, small features of the sky (sun) at low sample counts.
+vec3 sky_radiance(vec3 direction, uint bounces) {
+    float lod = min(float(bounces) * uni.r.sky_lod_per_bounce, uni.r.max_sky_lod);
+    return textureLod(texSampler, dir_to_uv(normalize(direction)), lod).rgb;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef sphere_intersection_INC_HEADER_GUARD
+#define sphere_intersection_INC_HEADER_GUARD
+
+// Returns the closest intersection of the ray with the sphere surface inside [t_min, t_max].
+// Rays starting inside the sphere hit the far side (needed for refraction through the particles).
+// The normal always points out of the sphere.
+bool intersect_sphere(vec3 origin, vec3 direction, vec3 center, float radius, float t_min, float t_max,
+                      out float t_hit, out vec3 normal) {
+    vec3 oc = origin - center;
+    float a = dot(direction, direction);
+    float half_b = dot(oc, direction);
+    float c = dot(oc, oc) - radius * radius;
+    float discriminant = half_b * half_b - a * c;
+    if (discriminant < 0.0) {
+        return false;
+    }
+
+    float sqrt_d = sqrt(discriminant);
+    float t = (-half_b - sqrt_d) / a;
+    if (t <= t_min) {
+        t = (-half_b + sqrt_d) / a;
+    }
+    if (t <= t_min || t >= t_max) {
+        return false;
+    }
+
+    t_hit = t;
+    normal = (oc + direction * t) / radius;
+    return true;
+}
+
+#endif
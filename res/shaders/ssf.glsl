@@ -0,0 +1,45 @@
+#ifndef ssf_INC_HEADER_GUARD
+#define ssf_INC_HEADER_GUARD
+
+// Screen space fluid (ssf_splat.comp -> ssf_smooth.comp -> ssf_shade.comp), runs at the trace resolution.
+// The including shader has to declare `uni` before including this file.
+// Depths are distances along the view direction, so neighbouring pixels of a flat surface differ linearly.
+
+const uint SSF_EMPTY_DEPTH = 0xffffffffu; // cleared splat depth (larger than the bits of any positive float)
+const float SSF_THICKNESS_SCALE = 1024.0; // fixed point scale of the accumulated thickness
+
+vec3 ssf_camera_position() {
+    return (uni.inv_view * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+}
+
+vec3 ssf_view_direction() {
+    vec4 target = uni.inv_proj * vec4(0.0, 0.0, 1.0, 1.0);
+    return normalize((uni.inv_view * vec4(normalize(target.xyz), 0.0)).xyz);
+}
+
+// world space direction of the camera ray through the pixel center (same as camera_ray.glsl without jitter)
+vec3 ssf_pixel_direction(ivec2 coords) {
+    vec2 uv = (vec2(coords) + 0.5) / vec2(uni.trace_viewport.zw);
+    vec4 target = uni.inv_proj * vec4(uv * 2.0 - 1.0, 1.0, 1.0);
+    return normalize((uni.inv_view * vec4(normalize(target.xyz), 0.0)).xyz);
+}
+
+float ssf_sphere_radius() {
+    return uni.mesh_gen.kernel_radius * 128 * uni.r.ssf_radius_scale * length(uni.fluid_model[0].xyz);
+}
+
+// world space position of a depth along the view direction
+vec3 ssf_position(ivec2 coords, float depth) {
+    vec3 direction = ssf_pixel_direction(coords);
+    return ssf_camera_position() + direction * (depth / dot(direction, ssf_view_direction()));
+}
+
+// pixels per world unit at the given depth
+float ssf_pixel_scale(float depth) {
+    vec3 center = ssf_camera_position() + ssf_view_direction() * depth;
+    vec4 a = uni.proj_view * vec4(center, 1);
+    vec4 b = uni.proj_view * vec4(center + uni.inv_view[1].xyz, 1);
+    return length((b.xy / b.w - a.xy / a.w) * 0.5 * vec2(uni.trace_viewport.zw));
+}
+
+#endif
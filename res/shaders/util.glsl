@@ -16,7 +16,7 @@ struct mesh_generation_struct{
     float density_multiplier;
     float density_threshold;
 
-    uint _pad;
+    uint side_voxel_count;
 };
 
 struct rendering_struct{
@@ -29,10 +29,19 @@ struct rendering_struct{
     int min_secondary_ray_count;
 
     float secondary_ray_survival_probability;
+    uint cull_mask;
+    int adaptive_sampling;
+    int max_adaptive_spp;
+
+    float sky_lod_per_bounce;
+    float max_sky_lod;
+    float point_radius_scale;
+    float ssf_radius_scale;
 
+    float ssf_filter_radius;
+    float ssf_depth_falloff;
     uint _pad;
     uint __pad;
-    uint ___pad;
 };
 
 struct simulation_struct{
@@ -79,12 +88,26 @@ struct fluid_struct {
     uint __pad;
 };
 
+struct temporal_struct{
+    int enabled;
+    float min_blend_factor;
+    float clamp_gamma;
+    int reset;
+
+    uint frame_index;
+    int checkerboard;
+    uint _pad;
+    uint __pad;
+};
+
 struct uniform_data {
     mat4 inv_view;
     mat4 inv_proj;
     mat4 proj_view;
+    mat4 last_proj_view;
     mat4 fluid_model;
     uvec4 viewport;
+    uvec4 trace_viewport; // (0, 0, traced width, traced height), smaller than viewport with a render scale < 1
     vec4 background_color;
     float time;
     int swapchain_frame;
@@ -99,6 +122,7 @@ struct uniform_data {
     fluid_struct fluid;
     mesh_generation_struct mesh_gen;
     rendering_struct r;
+    temporal_struct t;
 };
 
 struct compute_uniform_data {
@@ -107,6 +131,9 @@ struct compute_uniform_data {
     uint particle_cells_per_side;
     uint side_voxel_count;
     uint side_force_field_size;
+    uint force_field_slot_count;
+    uint force_field_slot_stride;
+    uint force_field_format;
 };
 
 struct compute_return_data {
@@ -124,6 +151,11 @@ struct instance {
     uvec2 index_buf;
 };
 
+struct aabb {
+    vec3 min_corner;
+    vec3 max_corner;
+};
+
 struct vertex {
     vec3 position;
     vec3 normal;
@@ -144,10 +176,29 @@ struct ray_payload {
     bool water;
     vec3 position;
     vec3 direction;
+    vec3 normal; // world space normal of the last surface hit
     uint bounces;
     vec2 random;
 };
 
+// ray_payload of a path in flight of the wavefront tracer (see wavefront.glsl), 64 bytes
+struct wavefront_ray {
+    vec3 position;
+    uint pixel; // x | y << 16
+    vec3 direction;
+    uint state; // bounces | water << 30 | finished << 31
+    vec3 color_accumulation;
+    float random_x;
+    vec3 color_atenuation;
+    float random_y;
+};
+
+// visible particle of the point cloud (see point_cull.comp)
+struct point_vertex {
+    vec3 position; // world space
+    uint color; // packUnorm4x8
+};
+
 struct CoreParticle{
     vec3 pos;
     vec3 vel;
@@ -204,4 +255,20 @@ vec3 halton3d(int n) {
     return vec3(halton(n + 1, 2), halton(n + 1, 3), halton(n + 1, 5));
 }
 
+// checkerboard rendering: per frame only the pixels with an even (x + y + frame_index) are traced
+// fixed point scale of the summed sample allocation weights (each in [0, 1]): as fine as 1/1024, but coarse enough that
+// the weights of all traced pixels still add up to less than 2^32 (with headroom for the float rounding of the groups)
+float sample_weight_scale(uvec2 size) {
+    return min(1024.0, floor(4.29e9 / float(max(size.x * size.y, 1u))));
+}
+
+bool checkerboard_traced(ivec2 coords, uint frame_index) {
+    return ((uint(coords.x + coords.y) + frame_index) & 1u) == 0u;
+}
+
+// maps the launch id of a checkerboard trace (half width) to the traced pixel
+ivec2 checkerboard_pixel(uvec2 launch_id, uint frame_index) {
+    return ivec2(launch_id.x * 2u + ((launch_id.y + frame_index) & 1u), launch_id.y);
+}
+
 #endif
@@ -0,0 +1,73 @@
+#ifndef wavefront_INC_HEADER_GUARD
+#define wavefront_INC_HEADER_GUARD
+
+// Wavefront path tracer: every bounce is a separate pass over a queue of the paths still in flight.
+// wavefront_generate.comp -> (core_wavefront.rgen -> wavefront_compact.comp) per bounce, once per sample.
+// The two queues are used alternately: bounce b reads queue (b & 1) and the compaction writes queue ((b + 1) & 1).
+// The including shader has to declare `uni` (and the `payload` for pack/unpack) before including this file.
+
+layout (scalar, set = 0, binding = 10) restrict buffer WavefrontRayBuffer{
+    wavefront_ray rays[];
+};
+
+layout (scalar, set = 0, binding = 11) restrict buffer WavefrontQueueBuffer{
+    uint queues[]; // 2 * ray capacity
+};
+
+// one VkTraceRaysIndirectCommandKHR (width, height, depth) + padding per queue; width is the queue length
+layout (scalar, set = 0, binding = 12) restrict buffer WavefrontCommandBuffer{
+    uint commands[8];
+};
+
+layout (push_constant) uniform WavefrontConstants{
+    uint bounce;
+    uint sample_index;
+} wf;
+
+const uint WAVEFRONT_WATER = 1u << 30;
+const uint WAVEFRONT_FINISHED = 1u << 31;
+const uint WAVEFRONT_BOUNCES = WAVEFRONT_WATER - 1u;
+
+uint wavefront_capacity() {
+    return uni.trace_viewport.z * uni.trace_viewport.w;
+}
+
+uint queue_offset(uint bounce) {
+    return (bounce & 1u) * wavefront_capacity();
+}
+
+uint queue_length(uint bounce) {
+    return commands[(bounce & 1u) * 4u];
+}
+
+#ifdef WAVEFRONT_PAYLOAD
+ivec2 unpack_ray(wavefront_ray ray) {
+    payload.position = ray.position;
+    payload.direction = ray.direction;
+    payload.color_accumulation = ray.color_accumulation;
+    payload.color_atenuation = ray.color_atenuation;
+    payload.random = vec2(ray.random_x, ray.random_y);
+    payload.bounces = ray.state & WAVEFRONT_BOUNCES;
+    payload.water = (ray.state & WAVEFRONT_WATER) != 0u;
+    payload.finished = (ray.state & WAVEFRONT_FINISHED) != 0u;
+    payload.normal = vec3(0);
+    return ivec2(ray.pixel & 0xffffu, ray.pixel >> 16);
+}
+
+wavefront_ray pack_ray(ivec2 coords) {
+    wavefront_ray ray;
+    ray.position = payload.position;
+    ray.pixel = uint(coords.x) | (uint(coords.y) << 16);
+    ray.direction = payload.direction;
+    ray.state = min(payload.bounces, WAVEFRONT_BOUNCES) |
+                (payload.water ? WAVEFRONT_WATER : 0u) |
+                (payload.finished ? WAVEFRONT_FINISHED : 0u);
+    ray.color_accumulation = payload.color_accumulation;
+    ray.random_x = payload.random.x;
+    ray.color_atenuation = payload.color_atenuation;
+    ray.random_y = payload.random.y;
+    return ray;
+}
+#endif
+
+#endif